@@ -23,16 +23,37 @@
  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  }}} */
-#include <Python.h>
+#include "_fastcsv.h"
 
-extern PyTypeObject ReaderType;
-extern PyTypeObject WriterType;
+int
+FastCSV_BufferReserve(FastCSV_Buffer *buf, Py_ssize_t size) {
+  Py_ssize_t cap = buf->cap ? buf->cap : 256;
+  char *data;
+  if (size <= buf->cap) return 1;
+  while (cap < size) cap *= 2;
+  data = PyMem_Realloc(buf->data, cap);
+  if (!data) {
+    PyErr_NoMemory();
+    return 0;
+  }
+  buf->data = data;
+  buf->cap = cap;
+  return 1;
+}
+
+void
+FastCSV_BufferFree(FastCSV_Buffer *buf) {
+  PyMem_Free(buf->data);
+  buf->data = NULL;
+  buf->cap = 0;
+}
 
 static PyMethodDef _fastcsv_methods[] = {
+  { "_scanners", (PyCFunction)FastCSV_scanners, METH_NOARGS },
+  { "_set_scanner", (PyCFunction)FastCSV_set_scanner, METH_O },
   {NULL}
 };
 
-#if PY_MAJOR_VERSION >= 3
 static struct PyModuleDef moduledef = {
   PyModuleDef_HEAD_INIT,
   "_fastcsv",
@@ -47,8 +68,10 @@ static struct PyModuleDef moduledef = {
 
 PyMODINIT_FUNC
 PyInit__fastcsv(void) {
+  FastCSV_InitScanner();
   if (PyType_Ready(&ReaderType) < 0) return NULL;
   if (PyType_Ready(&WriterType) < 0) return NULL;
+  if (PyType_Ready(&LazyRowType) < 0) return NULL;
 
   PyObject *m = PyModule_Create(&moduledef);
   if (m == NULL) {
@@ -58,22 +81,7 @@ PyInit__fastcsv(void) {
   PyModule_AddObject(m, "Reader", (PyObject *)&ReaderType);
   Py_INCREF(&WriterType);
   PyModule_AddObject(m, "Writer", (PyObject *)&WriterType);
+  Py_INCREF(&LazyRowType);
+  PyModule_AddObject(m, "LazyRow", (PyObject *)&LazyRowType);
   return m;
 }
-#else
-PyMODINIT_FUNC
-init_fastcsv(void) {
-  if (PyType_Ready(&ReaderType) < 0) return;
-  if (PyType_Ready(&WriterType) < 0) return;
-
-  {
-    PyObject *m;
-    m = Py_InitModule("_fastcsv", _fastcsv_methods);
-
-    Py_INCREF(&ReaderType);
-    PyModule_AddObject(m, "Reader", (PyObject *)&ReaderType);
-    Py_INCREF(&WriterType);
-    PyModule_AddObject(m, "Writer", (PyObject *)&WriterType);
-  }
-}
-#endif
@@ -0,0 +1,477 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#ifndef FASTCSV_H
+#define FASTCSV_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#if PY_VERSION_HEX < 0x03030000
+#error "fastcsv requires Python 3.3 or later (PEP 393 strings)"
+#endif
+
+/* PyUnicode_READY is a no-op (and deprecated) since Python 3.12. */
+#if PY_VERSION_HEX < 0x030C0000
+#define FASTCSV_READY(op) PyUnicode_READY(op)
+#else
+#define FASTCSV_READY(op) 0
+#endif
+
+extern PyTypeObject ReaderType;
+extern PyTypeObject WriterType;
+extern PyTypeObject LazyRowType;
+
+/* Copies characters from one PEP 393 kind to another, same as
+   _PyUnicode_CONVERT_BYTES in CPython. Widening only; the caller makes sure
+   that every character fits in to_type. */
+#define FASTCSV_CONVERT_CHARS(from_type, to_type, begin, end, to) \
+  do { \
+    const from_type *_iter = (const from_type *)(begin); \
+    const from_type *_end = (const from_type *)(end); \
+    to_type *_to = (to_type *)(to); \
+    while (_iter < _end) *_to++ = (to_type)*_iter++; \
+  } while (0)
+
+/* Growable scratch memory owned by a Reader or a Writer. */
+typedef struct {
+  char *data;
+  Py_ssize_t cap;
+} FastCSV_Buffer;
+
+/* Makes buf->cap at least size bytes. Returns 0 and sets MemoryError on
+   failure. The contents are preserved. */
+int FastCSV_BufferReserve(FastCSV_Buffer *buf, Py_ssize_t size);
+void FastCSV_BufferFree(FastCSV_Buffer *buf);
+
+/* Read-only mapping of a whole file (_fastcsv_mmap.c). */
+typedef struct {
+  char *data;
+  Py_ssize_t size;
+} FastCSV_Mapping;
+
+int FastCSV_MapFile(PyObject *path, FastCSV_Mapping *map);
+void FastCSV_UnmapFile(FastCSV_Mapping *map);
+
+/* Structural character scanner (_fastcsv_scan.c).
+
+   A FindAny kernel returns the index of the first character in buf[curr..end)
+   that is one of the (up to four) ASCII characters in the set, or end. There
+   are kernels for every PEP 393 kind, indexed by FASTCSV_KIND_INDEX. */
+typedef struct {
+  /* Unused slots repeat c[0]. */
+  unsigned char c[4];
+} FastCSV_CharSet;
+
+typedef Py_ssize_t (*FastCSV_FindFunc)(const void *buf, Py_ssize_t curr,
+                                       Py_ssize_t end,
+                                       const FastCSV_CharSet *set);
+
+typedef struct {
+  const char *name;
+  FastCSV_FindFunc find[3];
+} FastCSV_Scanner;
+
+#define FASTCSV_KIND_INDEX(kind) ((kind) >> 1)
+
+extern const FastCSV_Scanner *fastcsv_scanner;
+
+void FastCSV_InitScanner(void);
+void FastCSV_InitCharSet(FastCSV_CharSet *set, const char *chars);
+PyObject *FastCSV_scanners(PyObject *module, PyObject *args);
+PyObject *FastCSV_set_scanner(PyObject *module, PyObject *arg);
+
+/* Record parser (_fastcsv_parser.c).
+
+   The parser finds the cells of one record at a time in a buffer of PEP 393
+   characters (or raw bytes in bytes mode). It only records the spans of the
+   cells, and does not touch any Python object, so it can run without the
+   GIL. The owner of the parser provides the buffer and creates the cells
+   from the spans. */
+typedef enum {
+  UniversalNewline,
+  LF,
+  CR,
+  CRLF,
+} FastCSV_NewlineMode;
+
+typedef enum {
+  EXPECT_CELL,
+  IN_CELL,
+  IN_QUOTE,
+  OUT_QUOTE,
+  /* Skipping the cells after span_limit. */
+  SKIP_REST,
+  SKIP_QUOTE,
+} FastCSV_ParserState;
+
+typedef enum {
+  PARSE_RECORD,
+  PARSE_NEED_MORE,
+  PARSE_END,
+  PARSE_ERROR,
+} FastCSV_ParseResult;
+
+/* Flags of FastCSV_CellSpan */
+#define FASTCSV_CELL_QUOTED 1
+#define FASTCSV_CELL_ESCAPED 2
+
+/* A cell of a record. start and end are offsets in the buffer. For a quoted
+   cell, they exclude the enclosing quotes, and FASTCSV_CELL_ESCAPED tells
+   that the cell contains doubled quotes. */
+typedef struct {
+  Py_ssize_t start, end;
+  unsigned char flags;
+} FastCSV_CellSpan;
+
+typedef struct {
+  /* The buffer holds buf_len characters of buf_kind. The characters before
+     buf_pos are consumed. eof tells that no more data comes after buf_len.
+     The parser never allocates nor frees buf. */
+  FastCSV_Buffer buf;
+  int buf_kind;
+  Py_ssize_t buf_len, buf_pos;
+  unsigned char eof;
+
+  FastCSV_NewlineMode newline_mode;
+  /* Characters that stop the scan in a quoted cell, in the skipped cells
+     and in the other states. */
+  FastCSV_CharSet quote_set, skip_set, cell_set;
+  /* If positive, only the first span_limit cells of a record are added.
+     The rest of the record is scanned for quotes and lineendings only, and
+     its syntax is not checked. */
+  Py_ssize_t span_limit;
+
+  /* State of the current record. Every offset is in the buffer. */
+  FastCSV_ParserState state;
+  Py_ssize_t scan_pos, cell_start, quote_end;
+  unsigned char cell_flags;
+  /* The last record ended with CR at the end of the data, and LF that
+     follows it should be skipped. */
+  unsigned char skip_lf;
+
+  /* Spans of the parsed cells. The spans of the current record begin at
+     span_base. The owner removes the spans it has consumed. */
+  Py_ssize_t span_base, span_count, span_cap;
+  FastCSV_CellSpan *spans;
+
+  /* Set on PARSE_ERROR. The owner raises error_type with error. */
+  PyObject *error_type;
+  const char *error;
+} FastCSV_Parser;
+
+void FastCSV_InitParser(FastCSV_Parser *parser,
+                        FastCSV_NewlineMode newline_mode);
+void FastCSV_FreeParser(FastCSV_Parser *parser);
+/* Drops the current record and starts a new one at buf_pos. */
+void FastCSV_ResetParser(FastCSV_Parser *parser);
+/* Moves the characters from buf_pos to the head of the buffer. */
+void FastCSV_CompactParser(FastCSV_Parser *parser);
+FastCSV_ParseResult FastCSV_ParseRecord(FastCSV_Parser *parser);
+/* Copies the size characters of an escaped cell into to, replacing every
+   doubled quote with one. Returns the number of the copied characters. */
+Py_ssize_t FastCSV_Unescape(int kind, const char *from, Py_ssize_t size,
+                            char *to);
+
+/* Parallel parsing of a mapped file (_fastcsv_parallel.c).
+
+   A window of the file is split into chunks, one per thread. The first pass
+   counts the quotes of every chunk and finds the first lineending in it for
+   both quote parities. Since a quote toggles whether the position is in a
+   quoted cell, the parity of the quotes before a chunk tells which of the
+   two lineendings begins a record. The second pass parses the records
+   from there in every range. Every pass runs without the GIL. */
+typedef struct {
+  /* Records that begin in [start, end) of the data. The parser stops after
+     the record that crosses end. */
+  Py_ssize_t start, end;
+  FastCSV_Parser parser;
+  /* The spans of record i are
+     parser.spans[record_ends[i - 1] .. record_ends[i]). */
+  Py_ssize_t record_count, record_cap;
+  Py_ssize_t *record_ends;
+  /* The parser stopped by PARSE_ERROR after the records. */
+  unsigned char failed;
+} FastCSV_Range;
+
+/* Parses the records that begin in data[start .. start + threads *
+   chunk_size) on threads, with the newline mode and the span limit of
+   config. ranges should have room for threads ranges.
+   Returns the number of the ranges, or -1 with an exception. The end of a
+   range may not be the start of the next one if the input is malformed;
+   the caller has to check it. */
+Py_ssize_t FastCSV_ParseParallel(const char *data, Py_ssize_t size,
+                                 Py_ssize_t start, Py_ssize_t chunk_size,
+                                 const FastCSV_Parser *config,
+                                 FastCSV_Range *ranges, Py_ssize_t threads);
+void FastCSV_FreeRanges(FastCSV_Range *ranges, Py_ssize_t count);
+
+/* Record offset index (_fastcsv_index.c).
+
+   An index has the offsets of the records every, 2 * every, ... of a mapped
+   file, counting the first record after the BOM as 0. The records are found
+   by a parser that keeps only the first cell and skips the rest with the
+   structural scan, so the quotes are resolved the same way as in reading
+   and no cell is created. The index file stores the offsets as LEB128
+   deltas after a header that identifies the file. */
+typedef struct {
+  FastCSV_NewlineMode newline_mode;
+  Py_ssize_t every, file_size, record_count;
+  /* offsets[i] is the offset of the record (i + 1) * every. */
+  Py_ssize_t offset_count;
+  Py_ssize_t *offsets;
+} FastCSV_Index;
+
+/* Finds the records in data[start .. size) with the newline mode of config,
+   without the GIL. index->every should be set. Returns 0 with an exception
+   on error. */
+int FastCSV_BuildIndex(const FastCSV_Parser *config, const char *data,
+                       Py_ssize_t size, Py_ssize_t start,
+                       FastCSV_Index *index);
+int FastCSV_WriteIndex(PyObject *path, const FastCSV_Index *index);
+int FastCSV_ReadIndex(PyObject *path, FastCSV_Index *index);
+void FastCSV_FreeIndex(FastCSV_Index *index);
+
+/* Typed columns (_fastcsv_convert.c).
+
+   A cell of a typed column is converted from the characters in the buffer
+   (or the raw bytes in bytes mode) without creating a str. An empty cell is
+   converted to None. */
+typedef enum {
+  FASTCSV_STR,
+  FASTCSV_INT64,
+  FASTCSV_FLOAT64,
+  FASTCSV_BOOL,
+  FASTCSV_DATE,
+} FastCSV_ColumnType;
+
+typedef struct {
+  FastCSV_ColumnType type;
+  /* strptime-like format of FASTCSV_DATE. */
+  char *format;
+} FastCSV_Converter;
+
+/* Parses a sequence of specs such as "int64" or "date:%Y-%m-%d". Returns
+   an array of *pcount converters, or NULL with an exception. */
+FastCSV_Converter *FastCSV_ParseSchema(PyObject *schema, Py_ssize_t *pcount);
+void FastCSV_FreeSchema(FastCSV_Converter *convs, Py_ssize_t count);
+/* Returns the value of the cell, or NULL with ValueError if the cell is
+   not valid for the type. */
+PyObject *FastCSV_Convert(const FastCSV_Converter *conv, int kind,
+                          const void *data, Py_ssize_t size);
+/* Parses a float in the same syntax as float(), except whitespace. Returns
+   1 and stores it into *pvalue, 0 if the cell is not a float, or -1 with an
+   exception. */
+int FastCSV_ParseDouble(int kind, const void *data, Py_ssize_t size,
+                        double *pvalue);
+
+/* Row filters (_fastcsv_filter.c).
+
+   A predicate is checked against the characters of a cell in the buffer
+   (or the raw bytes in bytes mode), so a record that does not match is
+   dropped without creating any object. */
+typedef enum {
+  /* The cell is one of the values. */
+  FASTCSV_MATCH_EQUAL,
+  /* The cell starts with one of the values. */
+  FASTCSV_MATCH_PREFIX,
+  /* The cell is a float between low and high. */
+  FASTCSV_MATCH_RANGE,
+} FastCSV_MatchType;
+
+typedef struct {
+  /* Index of the column. -1 until name is found in the header. */
+  Py_ssize_t column;
+  PyObject *name;
+  FastCSV_MatchType type;
+  /* str values, or bytes values encoded in the encoding of bytes mode. */
+  Py_ssize_t value_count;
+  PyObject **values;
+  double low, high;
+  unsigned char low_inclusive, high_inclusive;
+} FastCSV_Predicate;
+
+/* Parses a sequence of (column, op, value) tuples. encoding is the encoding
+   of bytes mode, or NULL. Returns an array of *pcount predicates, or NULL
+   with an exception. */
+FastCSV_Predicate *FastCSV_ParseWhere(PyObject *where, const char *encoding,
+                                      Py_ssize_t *pcount);
+void FastCSV_FreeWhere(FastCSV_Predicate *preds, Py_ssize_t count);
+/* Returns 1 if the cell matches, 0 if not, or -1 with an exception. */
+int FastCSV_MatchPredicate(const FastCSV_Predicate *pred, int kind,
+                           const void *data, Py_ssize_t size);
+
+/* Intern tables (_fastcsv_intern.c).
+
+   A table maps the raw characters of a cell (the bytes in bytes mode) to
+   the str created for them, so that a column with a few distinct values
+   shares one str per value. A table holds at most limit values, and a cell
+   longer than FASTCSV_INTERN_MAX_KEY bytes is never added. */
+#define FASTCSV_INTERN_MAX_KEY 256
+
+typedef struct {
+  Py_hash_t hash;
+  int kind;
+  Py_ssize_t key_size;
+  char *key;
+  /* NULL for an empty slot. */
+  PyObject *value;
+} FastCSV_InternEntry;
+
+typedef struct {
+  Py_ssize_t limit, count;
+  /* A power of 2, or 0 before the first value is added. */
+  Py_ssize_t slot_count;
+  FastCSV_InternEntry *slots;
+  Py_ssize_t hits, misses;
+} FastCSV_InternTable;
+
+void FastCSV_InitIntern(FastCSV_InternTable *table, Py_ssize_t limit);
+/* Removes every value and resets the counters. */
+void FastCSV_ClearIntern(FastCSV_InternTable *table);
+/* Returns a new reference to the value of the cell, or NULL without an
+   exception if it is not in the table. The hash of the cell is stored into
+   *phash for FastCSV_InternAdd. */
+PyObject *FastCSV_InternLookup(FastCSV_InternTable *table, int kind,
+                               const char *data, Py_ssize_t size,
+                               Py_hash_t *phash);
+/* Adds the value of the cell unless the table is full. Returns 0 with an
+   exception on error. */
+int FastCSV_InternAdd(FastCSV_InternTable *table, Py_hash_t hash, int kind,
+                      const char *data, Py_ssize_t size, PyObject *value);
+
+/* Lazy rows (_fastcsv_row.c).
+
+   A lazy row keeps a copy of the raw characters of its cells, and creates a
+   cell only when it is accessed. */
+typedef struct FastCSV_Codec FastCSV_Codec;
+
+/* Flag of a FastCSV_CellSpan of a lazy row: the record does not have the
+   cell, and it is None. */
+#define FASTCSV_CELL_MISSING 4
+
+typedef struct {
+  PyObject_VAR_HEAD
+  /* The cells as they were in the record, including the quotes, joined by
+     commas. size characters of kind, or raw bytes decoded by codec. */
+  int kind;
+  const FastCSV_Codec *codec;
+  PyObject *errors;
+  char *data;
+  Py_ssize_t size;
+  /* Py_SIZE(row) spans in data. */
+  FastCSV_CellSpan spans[1];
+} FastCSV_LazyRow;
+
+#define FastCSV_LazyRow_Check(op) PyObject_TypeCheck(op, &LazyRowType)
+
+/* Creates a lazy row of the cells columns[0 .. count) of a record in buf
+   (or the cells 0 .. count if columns is NULL). A column beyond span_count
+   is missing. codec and errors are the ones of bytes mode, or NULL. */
+PyObject *FastCSV_NewLazyRow(int kind, const char *buf,
+                             const FastCSV_CellSpan *spans,
+                             Py_ssize_t span_count,
+                             const Py_ssize_t *columns, Py_ssize_t count,
+                             const FastCSV_Codec *codec, PyObject *errors);
+/* Returns the str of data of a lazy row. */
+PyObject *FastCSV_LazyRowText(FastCSV_LazyRow *row);
+
+/* Built-in decoders and encoders (_fastcsv_codec.c).
+
+   Cells of a bytes mode Reader are decoded by these directly from the read
+   buffer. Every structural character (quote, splitter, CR and LF) is ASCII
+   and never appears inside a multibyte sequence of the supported encodings:
+   UTF-8 uses bytes >= 0x80 for them, and the trail bytes of Shift_JIS and
+   CP932 are >= 0x40. So the scanner can find the structure on the raw
+   bytes.
+
+   An encoder writes size characters of kind into out, which has room for
+   max_char_bytes bytes per character, and returns the number of the
+   written bytes. It returns -1 if a character cannot be encoded, and the
+   caller encodes them with the fallback codec instead. */
+typedef PyObject *(*FastCSV_DecodeFunc)(const FastCSV_Codec *codec,
+                                        const char *s, Py_ssize_t size,
+                                        const char *errors,
+                                        FastCSV_Buffer *scratch);
+typedef Py_ssize_t (*FastCSV_EncodeFunc)(const FastCSV_Codec *codec,
+                                         int kind, const void *data,
+                                         Py_ssize_t size, char *out);
+
+struct FastCSV_Codec {
+  /* The name returned by codecs.lookup(). */
+  const char *name;
+  /* The codec used when the cell is not valid. It raises the error or
+     applies the error handler in the same way as bytes.decode(). */
+  const char *fallback;
+  FastCSV_DecodeFunc decode;
+  /* Byte order mark skipped at the beginning of the stream. */
+  const char *bom;
+  FastCSV_EncodeFunc encode;
+  Py_ssize_t max_char_bytes;
+  /* Tables of the Shift_JIS family. See BuildShiftJISTable and
+     BuildShiftJISEncoder. */
+  Py_UCS2 *single;
+  Py_UCS2 *pairs;
+  Py_UCS2 *encode_map;
+};
+
+/* Returns the codec for the encoding name, or NULL with an exception. */
+const FastCSV_Codec *FastCSV_LookupCodec(PyObject *encoding);
+/* Same as FastCSV_LookupCodec, and prepares the encoder. */
+const FastCSV_Codec *FastCSV_LookupEncoder(PyObject *encoding);
+/* Returns the index of the first byte >= 0x80 in s, or size. */
+Py_ssize_t FastCSV_FindNonASCII(const char *s, Py_ssize_t size);
+
+/* Background writes to a file descriptor (_fastcsv_flusher.c).
+
+   A flusher owns depth + 1 buffers. The owner fills the current one and
+   submits it, and a native thread writes the submitted ones in order with
+   write(2), without the GIL. Submitting blocks only while depth buffers
+   are waiting, so the formatting of the next rows overlaps the writes. The
+   first failed write is kept and the later buffers are dropped. The
+   functions below except FastCSV_StartFlusher return 0 or its errno. */
+typedef struct FastCSV_Flusher FastCSV_Flusher;
+
+/* Starts the thread. Returns NULL with an exception. If closefd, fd is
+   closed when the flusher stops. If sync, fd is synchronized to the disk
+   by FastCSV_FlusherWait and FastCSV_StopFlusher. */
+FastCSV_Flusher *FastCSV_StartFlusher(int fd, Py_ssize_t buffer_size,
+                                      Py_ssize_t depth,
+                                      unsigned char closefd,
+                                      unsigned char sync);
+/* Returns the buffer to fill, which has buffer_size bytes. */
+char *FastCSV_FlusherBuffer(FastCSV_Flusher *f);
+/* Submits the first size bytes of the current buffer, and makes the next
+   one current. The current buffer is kept on error. */
+int FastCSV_FlusherSubmit(FastCSV_Flusher *f, Py_ssize_t size);
+/* Waits until every submitted buffer is written. */
+int FastCSV_FlusherWait(FastCSV_Flusher *f);
+/* Writes the submitted buffers, stops the thread and frees f. */
+int FastCSV_StopFlusher(FastCSV_Flusher *f);
+/* Opens path for writing, truncating it unless append. Returns the file
+   descriptor, or -1 with OSError. */
+int FastCSV_OpenForWrite(PyObject *path, unsigned char append);
+
+#endif
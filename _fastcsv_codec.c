@@ -0,0 +1,415 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+#include <string.h>
+
+#define INVALID_CHAR 0xFFFF
+
+Py_ssize_t
+FastCSV_FindNonASCII(const char *s, Py_ssize_t size) {
+  const unsigned char *p = (const unsigned char *)s;
+  Py_ssize_t i = 0;
+
+  for (; i + 8 <= size; i += 8) {
+    unsigned long long word;
+    memcpy(&word, p + i, 8);
+    if (word & 0x8080808080808080ULL) break;
+  }
+  for (; i < size; i++) {
+    if (p[i] & 0x80) break;
+  }
+  return i;
+}
+
+/* Support function: NewASCII
+   Creates a str from bytes that are known to be ASCII.
+ */
+static PyObject *
+NewASCII(const char *s, Py_ssize_t size) {
+  PyObject *ret = PyUnicode_New(size, 127);
+  if (!ret) return NULL;
+  memcpy(PyUnicode_DATA(ret), s, size);
+  return ret;
+}
+
+static PyObject *
+Fallback(const FastCSV_Codec *codec, const char *s, Py_ssize_t size,
+         const char *errors) {
+  return PyUnicode_Decode(s, size, codec->fallback, errors);
+}
+
+static PyObject *
+DecodeASCII(const FastCSV_Codec *codec, const char *s, Py_ssize_t size,
+            const char *errors, FastCSV_Buffer *scratch) {
+  if (FastCSV_FindNonASCII(s, size) == size) return NewASCII(s, size);
+  return Fallback(codec, s, size, errors);
+}
+
+static PyObject *
+DecodeLatin1(const FastCSV_Codec *codec, const char *s, Py_ssize_t size,
+             const char *errors, FastCSV_Buffer *scratch) {
+  if (FastCSV_FindNonASCII(s, size) == size) return NewASCII(s, size);
+  return PyUnicode_DecodeLatin1(s, size, errors);
+}
+
+static PyObject *
+DecodeUTF8(const FastCSV_Codec *codec, const char *s, Py_ssize_t size,
+           const char *errors, FastCSV_Buffer *scratch) {
+  if (FastCSV_FindNonASCII(s, size) == size) return NewASCII(s, size);
+  return PyUnicode_DecodeUTF8(s, size, errors);
+}
+
+/* Decoder: DecodeShiftJIS
+   Decodes Shift_JIS and CP932 with the tables built by BuildShiftJISTable.
+   ASCII runs are copied as they are. The characters are decoded into a UCS2
+   scratch buffer first, and then copied into a str of the right kind.
+ */
+static PyObject *
+DecodeShiftJIS(const FastCSV_Codec *codec, const char *s, Py_ssize_t size,
+               const char *errors, FastCSV_Buffer *scratch) {
+  const unsigned char *p = (const unsigned char *)s;
+  Py_ssize_t i, len;
+  Py_UCS2 *out;
+  Py_UCS4 maxchar = 127;
+  PyObject *ret;
+
+  i = FastCSV_FindNonASCII(s, size);
+  if (i == size) return NewASCII(s, size);
+
+  if (!FastCSV_BufferReserve(scratch, size * sizeof(Py_UCS2))) return NULL;
+  out = (Py_UCS2 *)scratch->data;
+  for (len = 0; len < i; len++) out[len] = p[len];
+
+  while (i < size) {
+    Py_UCS2 c;
+    if (p[i] < 0x80) {
+      Py_ssize_t run = i + FastCSV_FindNonASCII(s + i, size - i);
+      for (; i < run; i++) out[len++] = p[i];
+      continue;
+    }
+    c = codec->single[p[i]];
+    if (c != INVALID_CHAR) {
+      i++;
+    } else if (i + 1 < size &&
+               (c = codec->pairs[(p[i] << 8) | p[i + 1]]) != INVALID_CHAR) {
+      i += 2;
+    } else {
+      return Fallback(codec, s, size, errors);
+    }
+    if (c > maxchar) maxchar = c;
+    out[len++] = c;
+  }
+
+  ret = PyUnicode_New(len, maxchar);
+  if (!ret) return NULL;
+  if (PyUnicode_KIND(ret) == PyUnicode_2BYTE_KIND) {
+    memcpy(PyUnicode_DATA(ret), out, len * sizeof(Py_UCS2));
+  } else {
+    Py_UCS1 *data = PyUnicode_1BYTE_DATA(ret);
+    for (i = 0; i < len; i++) data[i] = (Py_UCS1)out[i];
+  }
+  return ret;
+}
+
+/* Support function: EncodeBelow
+   Copies the characters as bytes if every one is less than limit.
+ */
+static Py_ssize_t
+EncodeBelow(int kind, const void *data, Py_ssize_t size, char *out,
+            Py_UCS4 limit) {
+  Py_ssize_t i;
+  if (kind == PyUnicode_1BYTE_KIND) {
+    if (limit <= 0x80 && FastCSV_FindNonASCII(data, size) < size) return -1;
+    memcpy(out, data, size);
+    return size;
+  }
+  for (i = 0; i < size; i++) {
+    const Py_UCS4 c = PyUnicode_READ(kind, data, i);
+    if (c >= limit) return -1;
+    out[i] = (char)c;
+  }
+  return size;
+}
+
+static Py_ssize_t
+EncodeASCII(const FastCSV_Codec *codec, int kind, const void *data,
+            Py_ssize_t size, char *out) {
+  return EncodeBelow(kind, data, size, out, 0x80);
+}
+
+static Py_ssize_t
+EncodeLatin1(const FastCSV_Codec *codec, int kind, const void *data,
+             Py_ssize_t size, char *out) {
+  return EncodeBelow(kind, data, size, out, 0x100);
+}
+
+/* Encoder: EncodeUTF8
+   ASCII runs of a latin-1 str are copied as they are. Lone surrogates are
+   left to the fallback codec, which applies the error handler.
+ */
+static Py_ssize_t
+EncodeUTF8(const FastCSV_Codec *codec, int kind, const void *data,
+           Py_ssize_t size, char *out) {
+  unsigned char *p = (unsigned char *)out;
+  Py_ssize_t i = 0;
+
+  if (kind == PyUnicode_1BYTE_KIND) {
+    const Py_UCS1 *s = (const Py_UCS1 *)data;
+    while (i < size) {
+      const Py_ssize_t run = i + FastCSV_FindNonASCII((const char *)s + i,
+                                                      size - i);
+      memcpy(p, s + i, run - i);
+      p += run - i;
+      i = run;
+      if (i < size) {
+        *p++ = 0xc0 | (s[i] >> 6);
+        *p++ = 0x80 | (s[i] & 0x3f);
+        i++;
+      }
+    }
+    return (char *)p - out;
+  }
+  for (; i < size; i++) {
+    const Py_UCS4 c = PyUnicode_READ(kind, data, i);
+    if (c < 0x80) {
+      *p++ = (unsigned char)c;
+    } else if (c < 0x800) {
+      *p++ = 0xc0 | (c >> 6);
+      *p++ = 0x80 | (c & 0x3f);
+    } else if (c < 0x10000) {
+      if (c >= 0xd800 && c <= 0xdfff) return -1;
+      *p++ = 0xe0 | (c >> 12);
+      *p++ = 0x80 | ((c >> 6) & 0x3f);
+      *p++ = 0x80 | (c & 0x3f);
+    } else {
+      *p++ = 0xf0 | (c >> 18);
+      *p++ = 0x80 | ((c >> 12) & 0x3f);
+      *p++ = 0x80 | ((c >> 6) & 0x3f);
+      *p++ = 0x80 | (c & 0x3f);
+    }
+  }
+  return (char *)p - out;
+}
+
+/* Encoder: EncodeShiftJIS
+   Encodes Shift_JIS and CP932 with the map built by BuildShiftJISEncoder.
+ */
+static Py_ssize_t
+EncodeShiftJIS(const FastCSV_Codec *codec, int kind, const void *data,
+               Py_ssize_t size, char *out) {
+  unsigned char *p = (unsigned char *)out;
+  Py_ssize_t i;
+
+  for (i = 0; i < size; i++) {
+    const Py_UCS4 c = PyUnicode_READ(kind, data, i);
+    Py_UCS2 code;
+    if (c < 0x80) {
+      *p++ = (unsigned char)c;
+      continue;
+    }
+    if (c > 0xffff) return -1;
+    code = codec->encode_map[c];
+    if (code == 0 || code == INVALID_CHAR) return -1;
+    if (code > 0xff) *p++ = (unsigned char)(code >> 8);
+    *p++ = (unsigned char)code;
+  }
+  return (char *)p - out;
+}
+
+/* Support function: DecodeOne
+   Decodes a short byte sequence with the Python codec. Returns the code
+   point if it decodes to exactly one BMP character, or INVALID_CHAR.
+ */
+static int
+DecodeOne(const char *name, const char *s, Py_ssize_t size, Py_UCS2 *pc) {
+  PyObject *str = PyUnicode_Decode(s, size, name, "strict");
+  if (!str) {
+    if (!PyErr_ExceptionMatches(PyExc_UnicodeDecodeError)) return 0;
+    PyErr_Clear();
+    *pc = INVALID_CHAR;
+    return 1;
+  }
+  if (PyUnicode_GET_LENGTH(str) == 1 &&
+      PyUnicode_READ_CHAR(str, 0) < INVALID_CHAR) {
+    *pc = (Py_UCS2)PyUnicode_READ_CHAR(str, 0);
+  } else {
+    *pc = INVALID_CHAR;
+  }
+  Py_DECREF(str);
+  return 1;
+}
+
+/* Support function: BuildShiftJISTable
+   Builds the decoding tables from the Python codec once. single maps a byte
+   to a character, and pairs maps (lead << 8 | trail) to a character.
+   INVALID_CHAR means that the byte (sequence) is not a character by itself.
+   If a valid sequence contains a structural character as its trail byte,
+   the scanner could not work on the raw bytes, so the codec is rejected.
+ */
+static int
+BuildShiftJISTable(FastCSV_Codec *codec) {
+  Py_UCS2 *single, *pairs;
+  int lead, trail;
+
+  single = PyMem_New(Py_UCS2, 256);
+  pairs = PyMem_New(Py_UCS2, 256 * 256);
+  if (!single || !pairs) {
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  for (lead = 0; lead < 256 * 256; lead++) pairs[lead] = INVALID_CHAR;
+
+  for (lead = 0; lead < 256; lead++) {
+    char seq[2];
+    seq[0] = (char)lead;
+    if (!DecodeOne(codec->name, seq, 1, &single[lead])) goto error_exit;
+    if (lead < 0x80 || single[lead] != INVALID_CHAR) continue;
+
+    for (trail = 0; trail < 256; trail++) {
+      Py_UCS2 *pc = &pairs[(lead << 8) | trail];
+      seq[1] = (char)trail;
+      if (!DecodeOne(codec->name, seq, 2, pc)) goto error_exit;
+      if (*pc != INVALID_CHAR && trail != 0 && strchr("\",\r\n", trail)) {
+        PyErr_Format(PyExc_ValueError,
+                     "encoding %s is not supported", codec->name);
+        goto error_exit;
+      }
+    }
+  }
+  codec->single = single;
+  codec->pairs = pairs;
+  return 1;
+
+error_exit:
+  if (single) PyMem_Del(single);
+  if (pairs) PyMem_Del(pairs);
+  return 0;
+}
+
+/* Support function: BuildShiftJISEncoder
+   Builds encode_map, which maps a BMP character to its single byte (less
+   than 0x100) or to (lead << 8 | trail). Some characters have more than
+   one code, so every decodable character is encoded by the Python codec
+   once to take the code it chooses. 0 or INVALID_CHAR means that the
+   character is left to the fallback codec.
+ */
+static int
+BuildShiftJISEncoder(FastCSV_Codec *codec) {
+  Py_UCS2 *map;
+  int code;
+
+  map = PyMem_New(Py_UCS2, 0x10000);
+  if (!map) {
+    PyErr_NoMemory();
+    return 0;
+  }
+  memset(map, 0, sizeof(Py_UCS2) * 0x10000);
+  for (code = 0x80; code < 0x10000; code++) {
+    const Py_UCS2 c = (code < 0x100) ? codec->single[code]
+                                     : codec->pairs[code];
+    PyObject *str, *bytes;
+    if (c == INVALID_CHAR || c < 0x80 || map[c] != 0) continue;
+    map[c] = INVALID_CHAR;
+    str = PyUnicode_FromOrdinal(c);
+    if (!str) goto error_exit;
+    bytes = PyUnicode_AsEncodedString(str, codec->name, "strict");
+    Py_DECREF(str);
+    if (!bytes) {
+      if (!PyErr_ExceptionMatches(PyExc_UnicodeEncodeError)) goto error_exit;
+      PyErr_Clear();
+      continue;
+    }
+    if (PyBytes_GET_SIZE(bytes) == 1) {
+      map[c] = (unsigned char)PyBytes_AS_STRING(bytes)[0];
+    } else if (PyBytes_GET_SIZE(bytes) == 2) {
+      const unsigned char *b = (const unsigned char *)PyBytes_AS_STRING(bytes);
+      map[c] = (Py_UCS2)((b[0] << 8) | b[1]);
+    }
+    Py_DECREF(bytes);
+  }
+  codec->encode_map = map;
+  return 1;
+
+error_exit:
+  PyMem_Del(map);
+  return 0;
+}
+
+static FastCSV_Codec codecs[] = {
+  { "utf-8", "utf-8", DecodeUTF8, NULL, EncodeUTF8, 4 },
+  { "utf-8-sig", "utf-8", DecodeUTF8, "\xef\xbb\xbf", EncodeUTF8, 4 },
+  { "ascii", "ascii", DecodeASCII, NULL, EncodeASCII, 1 },
+  { "iso8859-1", "iso8859-1", DecodeLatin1, NULL, EncodeLatin1, 1 },
+  { "cp932", "cp932", DecodeShiftJIS, NULL, EncodeShiftJIS, 2 },
+  { "shift_jis", "shift_jis", DecodeShiftJIS, NULL, EncodeShiftJIS, 2 },
+};
+
+const FastCSV_Codec *
+FastCSV_LookupEncoder(PyObject *encoding) {
+  FastCSV_Codec *codec = (FastCSV_Codec *)FastCSV_LookupCodec(encoding);
+  if (!codec) return NULL;
+  if (codec->encode == EncodeShiftJIS && !codec->encode_map &&
+      !BuildShiftJISEncoder(codec)) {
+    return NULL;
+  }
+  return codec;
+}
+
+const FastCSV_Codec *
+FastCSV_LookupCodec(PyObject *encoding) {
+  PyObject *codecs_module, *info, *name;
+  const char *canonical;
+  size_t i;
+
+  codecs_module = PyImport_ImportModule("codecs");
+  if (!codecs_module) return NULL;
+  info = PyObject_CallMethod(codecs_module, "lookup", "O", encoding);
+  Py_DECREF(codecs_module);
+  if (!info) return NULL;
+  name = PyObject_GetAttrString(info, "name");
+  Py_DECREF(info);
+  if (!name) return NULL;
+  canonical = PyUnicode_AsUTF8(name);
+  if (!canonical) {
+    Py_DECREF(name);
+    return NULL;
+  }
+
+  for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+    FastCSV_Codec *codec = &codecs[i];
+    if (strcmp(codec->name, canonical) != 0) continue;
+    Py_DECREF(name);
+    if (codec->decode == DecodeShiftJIS && !codec->pairs &&
+        !BuildShiftJISTable(codec)) {
+      return NULL;
+    }
+    return codec;
+  }
+  PyErr_Format(PyExc_ValueError, "encoding %s is not supported", canonical);
+  Py_DECREF(name);
+  return NULL;
+}
@@ -0,0 +1,345 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+#include <datetime.h>
+
+/* Column types for the schema of Reader. */
+
+static const struct {
+  const char *name;
+  FastCSV_ColumnType type;
+} type_names[] = {
+  {"str", FASTCSV_STR},
+  {"int64", FASTCSV_INT64},
+  {"float64", FASTCSV_FLOAT64},
+  {"bool", FASTCSV_BOOL},
+  {"date", FASTCSV_DATE},
+};
+
+#define DEFAULT_DATE_FORMAT "%Y-%m-%d"
+
+/* Support function: CheckDateFormat
+   Returns 0 with ValueError if the format has a directive that ParseDate
+   does not know.
+ */
+static unsigned char
+CheckDateFormat(const char *format) {
+  const char *p;
+  for (p = format; *p; p++) {
+    if (*p != '%') continue;
+    p++;
+    if (!*p || !strchr("Ymdy%", *p)) {
+      PyErr_Format(PyExc_ValueError,
+                   "unsupported directive in date format: %s", format);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Support function: ParseSpec
+   Parses a spec like "int64" or "date:%Y/%m/%d" into conv.
+ */
+static unsigned char
+ParseSpec(PyObject *spec, FastCSV_Converter *conv) {
+  const char *str, *colon;
+  size_t name_len, i;
+
+  conv->type = FASTCSV_STR;
+  conv->format = NULL;
+  if (spec == Py_None) return 1;
+  if (!PyUnicode_Check(spec)) {
+    PyErr_SetString(PyExc_TypeError, "schema should be a sequence of str");
+    return 0;
+  }
+  str = PyUnicode_AsUTF8(spec);
+  if (!str) return 0;
+  colon = strchr(str, ':');
+  name_len = colon ? (size_t)(colon - str) : strlen(str);
+  for (i = 0; i < sizeof(type_names) / sizeof(type_names[0]); i++) {
+    if (strlen(type_names[i].name) == name_len &&
+        strncmp(type_names[i].name, str, name_len) == 0) {
+      conv->type = type_names[i].type;
+      break;
+    }
+  }
+  if (i == sizeof(type_names) / sizeof(type_names[0]) ||
+      (colon && conv->type != FASTCSV_DATE)) {
+    PyErr_Format(PyExc_ValueError, "unknown column type: %s", str);
+    return 0;
+  }
+  if (conv->type == FASTCSV_DATE) {
+    const char *format = colon ? colon + 1 : DEFAULT_DATE_FORMAT;
+    if (!CheckDateFormat(format)) return 0;
+    conv->format = PyMem_Malloc(strlen(format) + 1);
+    if (!conv->format) {
+      PyErr_NoMemory();
+      return 0;
+    }
+    strcpy(conv->format, format);
+    if (!PyDateTimeAPI) {
+      PyDateTime_IMPORT;
+      if (!PyDateTimeAPI) return 0;
+    }
+  }
+  return 1;
+}
+
+FastCSV_Converter *
+FastCSV_ParseSchema(PyObject *schema, Py_ssize_t *pcount) {
+  PyObject *seq;
+  FastCSV_Converter *convs;
+  Py_ssize_t count, i;
+
+  seq = PySequence_Fast(schema, "schema should be a sequence");
+  if (!seq) return NULL;
+  count = PySequence_Fast_GET_SIZE(seq);
+  /* Allocate one at least, since NULL means an error. */
+  convs = PyMem_New(FastCSV_Converter, count ? count : 1);
+  if (!convs) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return NULL;
+  }
+  for (i = 0; i < count; i++) {
+    if (!ParseSpec(PySequence_Fast_GET_ITEM(seq, i), &convs[i])) {
+      FastCSV_FreeSchema(convs, i + 1);
+      Py_DECREF(seq);
+      return NULL;
+    }
+  }
+  Py_DECREF(seq);
+  *pcount = count;
+  return convs;
+}
+
+void
+FastCSV_FreeSchema(FastCSV_Converter *convs, Py_ssize_t count) {
+  Py_ssize_t i;
+  if (!convs) return;
+  for (i = 0; i < count; i++) {
+    PyMem_Free(convs[i].format);
+  }
+  PyMem_Del(convs);
+}
+
+#define READ(i) PyUnicode_READ(kind, data, (i))
+
+static PyObject *
+Invalid(const char *type_name) {
+  PyErr_Format(PyExc_ValueError, "invalid %s value", type_name);
+  return NULL;
+}
+
+/* Support function: ParseInt64
+   Parses an optional sign and decimal digits.
+ */
+static PyObject *
+ParseInt64(int kind, const void *data, Py_ssize_t size) {
+  Py_ssize_t i = 0;
+  unsigned char negative = 0;
+  unsigned long long value = 0;
+  unsigned long long limit;
+
+  if (READ(0) == '-' || READ(0) == '+') {
+    negative = (READ(0) == '-');
+    i++;
+  }
+  if (i == size) return Invalid("int64");
+  limit = negative ? (unsigned long long)PY_LLONG_MAX + 1 : PY_LLONG_MAX;
+  for (; i < size; i++) {
+    const Py_UCS4 c = READ(i);
+    if (c < '0' || c > '9') return Invalid("int64");
+    if (value > (limit - (c - '0')) / 10) {
+      PyErr_SetString(PyExc_ValueError, "int64 value out of range");
+      return NULL;
+    }
+    value = value * 10 + (c - '0');
+  }
+  if (negative) {
+    /* -(2^63) does not fit in long long before the negation. */
+    return PyLong_FromLongLong(value == limit ? PY_LLONG_MIN
+                                              : -(long long)value);
+  }
+  return PyLong_FromLongLong((long long)value);
+}
+
+int
+FastCSV_ParseDouble(int kind, const void *data, Py_ssize_t size,
+                    double *pvalue)
+{
+  char small[64];
+  char *buf = small;
+  double value;
+  Py_ssize_t i;
+
+  if (size >= (Py_ssize_t)sizeof(small)) {
+    buf = PyMem_Malloc(size + 1);
+    if (!buf) {
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
+  for (i = 0; i < size; i++) {
+    const Py_UCS4 c = READ(i);
+    /* Only ASCII, and no whitespace that strtod skips. */
+    if (c <= ' ' || c >= 0x7f) break;
+    buf[i] = (char)c;
+  }
+  buf[i] = '\0';
+  value = -1.0;
+  if (i == size) {
+    /* Raises ValueError unless the whole buffer is a float. */
+    value = PyOS_string_to_double(buf, NULL, NULL);
+  }
+  if (buf != small) PyMem_Free(buf);
+  if (i != size || (value == -1.0 && PyErr_Occurred())) {
+    PyErr_Clear();
+    return 0;
+  }
+  *pvalue = value;
+  return 1;
+}
+
+/* Support function: ParseFloat64
+   Parses a float in the same syntax as float(), except whitespace.
+ */
+static PyObject *
+ParseFloat64(int kind, const void *data, Py_ssize_t size) {
+  double value;
+  const int ret = FastCSV_ParseDouble(kind, data, size, &value);
+  if (ret < 0) return NULL;
+  if (ret == 0) return Invalid("float64");
+  return PyFloat_FromDouble(value);
+}
+
+/* Support function: ParseBool
+   Accepts true/false and 1/0, case-insensitively.
+ */
+static PyObject *
+ParseBool(int kind, const void *data, Py_ssize_t size) {
+  static const char *words[] = {"false", "true", "0", "1"};
+  size_t w;
+  for (w = 0; w < sizeof(words) / sizeof(words[0]); w++) {
+    Py_ssize_t i;
+    if ((Py_ssize_t)strlen(words[w]) != size) continue;
+    for (i = 0; i < size; i++) {
+      Py_UCS4 c = READ(i);
+      if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+      if (c != (Py_UCS4)words[w][i]) break;
+    }
+    if (i == size) return PyBool_FromLong(w & 1);
+  }
+  return Invalid("bool");
+}
+
+/* Support function: ParseDigits
+   Reads from 1 to max_digits decimal digits at *pi.
+ */
+static unsigned char
+ParseDigits(int kind, const void *data, Py_ssize_t size, Py_ssize_t *pi,
+            int max_digits, int *value)
+{
+  int digits = 0;
+  *value = 0;
+  while (*pi < size && digits < max_digits) {
+    const Py_UCS4 c = READ(*pi);
+    if (c < '0' || c > '9') break;
+    *value = *value * 10 + (int)(c - '0');
+    (*pi)++;
+    digits++;
+  }
+  return digits > 0;
+}
+
+/* Support function: ParseDate
+   A subset of strptime that knows %Y, %m, %d, %y and %%.
+ */
+static PyObject *
+ParseDate(const char *format, int kind, const void *data, Py_ssize_t size) {
+  int year = 1900, month = 1, day = 1;
+  Py_ssize_t i = 0;
+  const char *p;
+
+  for (p = format; *p; p++) {
+    unsigned char ok = 1;
+    if (*p != '%') {
+      ok = (i < size && READ(i) == (Py_UCS4)(unsigned char)*p);
+      i++;
+    } else {
+      switch (*++p) {
+        case 'Y':
+          ok = ParseDigits(kind, data, size, &i, 4, &year);
+          break;
+        case 'y':
+          ok = ParseDigits(kind, data, size, &i, 2, &year);
+          /* Same as the POSIX convention used by time.strptime. */
+          year += (year < 69) ? 2000 : 1900;
+          break;
+        case 'm':
+          ok = ParseDigits(kind, data, size, &i, 2, &month);
+          break;
+        case 'd':
+          ok = ParseDigits(kind, data, size, &i, 2, &day);
+          break;
+        case '%':
+          ok = (i < size && READ(i) == '%');
+          i++;
+          break;
+      }
+    }
+    if (!ok) break;
+  }
+  if (*p || i != size) {
+    PyErr_Format(PyExc_ValueError, "invalid date value for format %s",
+                 format);
+    return NULL;
+  }
+  /* PyDate_FromDate checks the ranges of month and day. */
+  return PyDate_FromDate(year, month, day);
+}
+
+#undef READ
+
+PyObject *
+FastCSV_Convert(const FastCSV_Converter *conv, int kind, const void *data,
+                Py_ssize_t size)
+{
+  if (size == 0) Py_RETURN_NONE;
+  switch (conv->type) {
+    case FASTCSV_INT64:
+      return ParseInt64(kind, data, size);
+    case FASTCSV_FLOAT64:
+      return ParseFloat64(kind, data, size);
+    case FASTCSV_BOOL:
+      return ParseBool(kind, data, size);
+    case FASTCSV_DATE:
+      return ParseDate(conv->format, kind, data, size);
+    default:
+      return PyUnicode_FromKindAndData(kind, data, size);
+  }
+}
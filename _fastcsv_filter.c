@@ -0,0 +1,277 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+/* Predicates for the where parameter of Reader. */
+
+/* Support function: ParseValue
+   Takes a str value of a predicate. In bytes mode, it is encoded so that
+   it can be compared with the raw bytes of a cell.
+ */
+static PyObject *
+ParseValue(PyObject *value, const char *encoding) {
+  if (!PyUnicode_Check(value)) {
+    PyErr_Format(PyExc_TypeError, "where: %R is not str", value);
+    return NULL;
+  }
+  if (FASTCSV_READY(value) < 0) return NULL;
+  if (encoding) return PyUnicode_AsEncodedString(value, encoding, "strict");
+  Py_INCREF(value);
+  return value;
+}
+
+/* Support function: ParseValues
+   Takes a str value, or an iterable of them for "in" and "startswith".
+ */
+static unsigned char
+ParseValues(FastCSV_Predicate *pred, PyObject *value, unsigned char multi,
+            const char *encoding)
+{
+  PyObject *seq;
+  Py_ssize_t i, count;
+
+  if (!multi || PyUnicode_Check(value)) {
+    pred->values = PyMem_New(PyObject *, 1);
+    if (!pred->values) {
+      PyErr_NoMemory();
+      return 0;
+    }
+    pred->values[0] = ParseValue(value, encoding);
+    if (!pred->values[0]) return 0;
+    pred->value_count = 1;
+    return 1;
+  }
+  seq = PySequence_Fast(value, "where: values should be iterable");
+  if (!seq) return 0;
+  count = PySequence_Fast_GET_SIZE(seq);
+  pred->values = PyMem_New(PyObject *, count ? count : 1);
+  if (!pred->values) {
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  for (i = 0; i < count; i++) {
+    pred->values[i] = ParseValue(PySequence_Fast_GET_ITEM(seq, i), encoding);
+    if (!pred->values[i]) goto error_exit;
+    pred->value_count++;
+  }
+  Py_DECREF(seq);
+  return 1;
+
+error_exit:
+  Py_DECREF(seq);
+  return 0;
+}
+
+/* Support function: ParseBound
+   Takes a bound of a range. None means no bound.
+ */
+static unsigned char
+ParseBound(PyObject *value, double *pbound, double none) {
+  if (value == Py_None) {
+    *pbound = none;
+    return 1;
+  }
+  *pbound = PyFloat_AsDouble(value);
+  return !(*pbound == -1.0 && PyErr_Occurred());
+}
+
+/* Support function: ParsePredicate
+   Parses a (column, op, value) tuple into pred.
+ */
+static unsigned char
+ParsePredicate(PyObject *item, FastCSV_Predicate *pred,
+               const char *encoding)
+{
+  PyObject *column, *value;
+  const char *op;
+
+  if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 3) {
+    PyErr_SetString(PyExc_TypeError,
+                    "where should be a sequence of (column, op, value)");
+    return 0;
+  }
+  column = PyTuple_GET_ITEM(item, 0);
+  value = PyTuple_GET_ITEM(item, 2);
+  if (!PyUnicode_Check(PyTuple_GET_ITEM(item, 1))) {
+    PyErr_SetString(PyExc_TypeError, "where: op should be str");
+    return 0;
+  }
+  op = PyUnicode_AsUTF8(PyTuple_GET_ITEM(item, 1));
+  if (!op) return 0;
+
+  if (PyUnicode_Check(column)) {
+    Py_INCREF(column);
+    pred->name = column;
+  } else {
+    pred->column = PyNumber_AsSsize_t(column, PyExc_OverflowError);
+    if (pred->column == -1 && PyErr_Occurred()) return 0;
+    if (pred->column < 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "where: column should not be negative");
+      return 0;
+    }
+  }
+
+  pred->low = -Py_HUGE_VAL;
+  pred->high = Py_HUGE_VAL;
+  pred->low_inclusive = pred->high_inclusive = 1;
+  if (strcmp(op, "==") == 0 || strcmp(op, "in") == 0) {
+    pred->type = FASTCSV_MATCH_EQUAL;
+    return ParseValues(pred, value, op[0] == 'i', encoding);
+  } else if (strcmp(op, "startswith") == 0) {
+    pred->type = FASTCSV_MATCH_PREFIX;
+    return ParseValues(pred, value, 1, encoding);
+  }
+  pred->type = FASTCSV_MATCH_RANGE;
+  if (strcmp(op, "between") == 0) {
+    PyObject *seq = PySequence_Fast(value,
+                                    "where: between takes (low, high)");
+    unsigned char ok;
+    if (!seq) return 0;
+    if (PySequence_Fast_GET_SIZE(seq) != 2) {
+      PyErr_SetString(PyExc_ValueError, "where: between takes (low, high)");
+      Py_DECREF(seq);
+      return 0;
+    }
+    ok = (ParseBound(PySequence_Fast_GET_ITEM(seq, 0), &pred->low,
+                     -Py_HUGE_VAL) &&
+          ParseBound(PySequence_Fast_GET_ITEM(seq, 1), &pred->high,
+                     Py_HUGE_VAL));
+    Py_DECREF(seq);
+    return ok;
+  } else if (strcmp(op, "<") == 0 || strcmp(op, "<=") == 0) {
+    pred->high_inclusive = (op[1] == '=');
+    return ParseBound(value, &pred->high, Py_HUGE_VAL);
+  } else if (strcmp(op, ">") == 0 || strcmp(op, ">=") == 0) {
+    pred->low_inclusive = (op[1] == '=');
+    return ParseBound(value, &pred->low, -Py_HUGE_VAL);
+  }
+  PyErr_Format(PyExc_ValueError, "where: unknown op: %s", op);
+  return 0;
+}
+
+FastCSV_Predicate *
+FastCSV_ParseWhere(PyObject *where, const char *encoding, Py_ssize_t *pcount)
+{
+  PyObject *seq;
+  FastCSV_Predicate *preds;
+  Py_ssize_t count, i;
+
+  seq = PySequence_Fast(where, "where should be a sequence");
+  if (!seq) return NULL;
+  count = PySequence_Fast_GET_SIZE(seq);
+  /* Allocate one at least, since NULL means an error. */
+  preds = PyMem_New(FastCSV_Predicate, count ? count : 1);
+  if (!preds) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return NULL;
+  }
+  for (i = 0; i < count; i++) {
+    FastCSV_Predicate *pred = &preds[i];
+    pred->column = -1;
+    pred->name = NULL;
+    pred->value_count = 0;
+    pred->values = NULL;
+    if (!ParsePredicate(PySequence_Fast_GET_ITEM(seq, i), pred, encoding)) {
+      FastCSV_FreeWhere(preds, i + 1);
+      Py_DECREF(seq);
+      return NULL;
+    }
+  }
+  Py_DECREF(seq);
+  *pcount = count;
+  return preds;
+}
+
+void
+FastCSV_FreeWhere(FastCSV_Predicate *preds, Py_ssize_t count) {
+  Py_ssize_t i, j;
+  if (!preds) return;
+  for (i = 0; i < count; i++) {
+    Py_XDECREF(preds[i].name);
+    for (j = 0; j < preds[i].value_count; j++) {
+      Py_DECREF(preds[i].values[j]);
+    }
+    if (preds[i].values) PyMem_Del(preds[i].values);
+  }
+  PyMem_Del(preds);
+}
+
+/* Support function: SameChars
+   Compares size characters of two PEP 393 buffers.
+ */
+static unsigned char
+SameChars(int kind, const void *data, int value_kind, const void *value,
+          Py_ssize_t size)
+{
+  Py_ssize_t i;
+  if (kind == value_kind) return memcmp(data, value, size * kind) == 0;
+  for (i = 0; i < size; i++) {
+    if (PyUnicode_READ(kind, data, i) !=
+        PyUnicode_READ(value_kind, value, i)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int
+FastCSV_MatchPredicate(const FastCSV_Predicate *pred, int kind,
+                       const void *data, Py_ssize_t size)
+{
+  Py_ssize_t i;
+
+  if (pred->type == FASTCSV_MATCH_RANGE) {
+    double value;
+    const int ret = FastCSV_ParseDouble(kind, data, size, &value);
+    if (ret <= 0) return ret;
+    return ((pred->low_inclusive ? value >= pred->low : value > pred->low) &&
+            (pred->high_inclusive ? value <= pred->high
+                                  : value < pred->high));
+  }
+  for (i = 0; i < pred->value_count; i++) {
+    PyObject *value = pred->values[i];
+    Py_ssize_t len;
+    int value_kind;
+    const void *value_data;
+
+    if (PyBytes_Check(value)) {
+      len = PyBytes_GET_SIZE(value);
+      value_kind = PyUnicode_1BYTE_KIND;
+      value_data = PyBytes_AS_STRING(value);
+    } else {
+      len = PyUnicode_GET_LENGTH(value);
+      value_kind = PyUnicode_KIND(value);
+      value_data = PyUnicode_DATA(value);
+    }
+    if (pred->type == FASTCSV_MATCH_EQUAL ? len != size : len > size) {
+      continue;
+    }
+    if (SameChars(kind, data, value_kind, value_data, len)) return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,321 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+
+#include "_fastcsv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include "pythread.h"
+#ifdef MS_WINDOWS
+#include <windows.h>
+#include <io.h>
+#include <limits.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* A mutex and condition variables of the platform. PyThread has only
+   locks, which cannot wake every waiter at once. */
+#ifdef MS_WINDOWS
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Cond;
+#define MutexInit(m) (InitializeSRWLock(m), 1)
+#define MutexFree(m) ((void)0)
+#define MutexLock(m) AcquireSRWLockExclusive(m)
+#define MutexUnlock(m) ReleaseSRWLockExclusive(m)
+#define CondInit(c) (InitializeConditionVariable(c), 1)
+#define CondFree(c) ((void)0)
+#define CondWait(c, m) SleepConditionVariableSRW((c), (m), INFINITE, 0)
+#define CondBroadcast(c) WakeAllConditionVariable(c)
+#else
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+#define MutexInit(m) (pthread_mutex_init((m), NULL) == 0)
+#define MutexFree(m) pthread_mutex_destroy(m)
+#define MutexLock(m) pthread_mutex_lock(m)
+#define MutexUnlock(m) pthread_mutex_unlock(m)
+#define CondInit(c) (pthread_cond_init((c), NULL) == 0)
+#define CondFree(c) pthread_cond_destroy(c)
+#define CondWait(c, m) pthread_cond_wait((c), (m))
+#define CondBroadcast(c) pthread_cond_broadcast(c)
+#endif
+
+struct FastCSV_Flusher {
+  int fd;
+  unsigned char closefd, sync;
+  /* count = depth + 1 buffers of buffer_size bytes. buffers[current] is
+     filled by the owner. */
+  Py_ssize_t count;
+  char **buffers;
+  Py_ssize_t *sizes;
+  Py_ssize_t current;
+
+  /* The fields below are guarded by mutex. buffers[head] and the next
+     pending - 1 ones are to be written in order. The thread waits on work
+     for a buffer to write, and the owner waits on space for a written
+     one. */
+  Mutex mutex;
+  Cond work, space;
+  Py_ssize_t head, pending;
+  unsigned char stopping;
+  /* errno of the first failed write. */
+  int error;
+  /* mutex, work and space are initialized. */
+  unsigned char sync_ready;
+  /* Released when the thread exits. */
+  PyThread_type_lock done;
+};
+
+/* Support function: WriteAll
+   Writes size bytes to fd, retrying after a partial write or a signal.
+   Returns 0 or errno.
+ */
+static int
+WriteAll(int fd, const char *data, Py_ssize_t size) {
+  while (size > 0) {
+#ifdef MS_WINDOWS
+    const int n = _write(fd, data,
+                         (unsigned int)(size < INT_MAX ? size : INT_MAX));
+#else
+    const Py_ssize_t n = write(fd, data, (size_t)size);
+#endif
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    data += n;
+    size -= n;
+  }
+  return 0;
+}
+
+static int
+Sync(int fd) {
+#ifdef MS_WINDOWS
+  return (_commit(fd) != 0) ? errno : 0;
+#else
+  return (fsync(fd) != 0) ? errno : 0;
+#endif
+}
+
+/* The thread writes the pending buffers until it is stopped. After a write
+   fails, the rest are dropped without being written. */
+static void
+RunFlusher(void *arg) {
+  FastCSV_Flusher *f = (FastCSV_Flusher *)arg;
+
+  MutexLock(&f->mutex);
+  for (;;) {
+    const char *data;
+    Py_ssize_t size;
+    int error;
+    while (f->pending == 0 && !f->stopping) CondWait(&f->work, &f->mutex);
+    if (f->pending == 0) break;
+    data = f->buffers[f->head];
+    size = f->sizes[f->head];
+    error = f->error;
+    MutexUnlock(&f->mutex);
+    if (!error) error = WriteAll(f->fd, data, size);
+    MutexLock(&f->mutex);
+    if (!f->error) f->error = error;
+    f->head = (f->head + 1) % f->count;
+    f->pending--;
+    CondBroadcast(&f->space);
+  }
+  MutexUnlock(&f->mutex);
+  PyThread_release_lock(f->done);
+}
+
+static void
+FreeFlusher(FastCSV_Flusher *f) {
+  Py_ssize_t i;
+  if (f->buffers) {
+    for (i = 0; i < f->count; i++) PyMem_Free(f->buffers[i]);
+    PyMem_Free(f->buffers);
+  }
+  PyMem_Free(f->sizes);
+  if (f->sync_ready) {
+    MutexFree(&f->mutex);
+    CondFree(&f->work);
+    CondFree(&f->space);
+  }
+  if (f->done) PyThread_free_lock(f->done);
+  PyMem_Free(f);
+}
+
+FastCSV_Flusher *
+FastCSV_StartFlusher(int fd, Py_ssize_t buffer_size, Py_ssize_t depth,
+                     unsigned char closefd, unsigned char sync)
+{
+  FastCSV_Flusher *f;
+  Py_ssize_t i;
+
+  f = PyMem_New(FastCSV_Flusher, 1);
+  if (!f) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  memset(f, 0, sizeof(*f));
+  f->fd = fd;
+  f->closefd = closefd;
+  f->sync = sync;
+  f->count = depth + 1;
+  f->buffers = PyMem_New(char *, f->count);
+  f->sizes = PyMem_New(Py_ssize_t, f->count);
+  if (!f->buffers || !f->sizes) {
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  memset(f->buffers, 0, sizeof(char *) * f->count);
+  for (i = 0; i < f->count; i++) {
+    f->buffers[i] = PyMem_Malloc(buffer_size);
+    if (!f->buffers[i]) {
+      PyErr_NoMemory();
+      goto error_exit;
+    }
+  }
+  if (!MutexInit(&f->mutex)) {
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  if (!CondInit(&f->work)) {
+    MutexFree(&f->mutex);
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  if (!CondInit(&f->space)) {
+    CondFree(&f->work);
+    MutexFree(&f->mutex);
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  f->sync_ready = 1;
+  f->done = PyThread_allocate_lock();
+  if (!f->done) {
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  /* Released only when the thread exits. */
+  PyThread_acquire_lock(f->done, WAIT_LOCK);
+  if (PyThread_start_new_thread(RunFlusher, f) == (unsigned long)-1) {
+    PyErr_SetString(PyExc_RuntimeError, "can't start new thread");
+    goto error_exit;
+  }
+  return f;
+
+error_exit:
+  FreeFlusher(f);
+  return NULL;
+}
+
+char *
+FastCSV_FlusherBuffer(FastCSV_Flusher *f) {
+  return f->buffers[f->current];
+}
+
+int
+FastCSV_FlusherSubmit(FastCSV_Flusher *f, Py_ssize_t size) {
+  int error;
+  Py_BEGIN_ALLOW_THREADS
+  MutexLock(&f->mutex);
+  /* One buffer is kept for the owner. */
+  while (f->pending == f->count - 1 && !f->error) {
+    CondWait(&f->space, &f->mutex);
+  }
+  error = f->error;
+  if (!error) {
+    f->sizes[f->current] = size;
+    f->current = (f->current + 1) % f->count;
+    f->pending++;
+    CondBroadcast(&f->work);
+  }
+  MutexUnlock(&f->mutex);
+  Py_END_ALLOW_THREADS
+  return error;
+}
+
+int
+FastCSV_FlusherWait(FastCSV_Flusher *f) {
+  int error;
+  Py_BEGIN_ALLOW_THREADS
+  MutexLock(&f->mutex);
+  while (f->pending > 0 && !f->error) CondWait(&f->space, &f->mutex);
+  error = f->error;
+  MutexUnlock(&f->mutex);
+  if (!error && f->sync) error = Sync(f->fd);
+  Py_END_ALLOW_THREADS
+  return error;
+}
+
+int
+FastCSV_StopFlusher(FastCSV_Flusher *f) {
+  int error;
+  Py_BEGIN_ALLOW_THREADS
+  MutexLock(&f->mutex);
+  f->stopping = 1;
+  CondBroadcast(&f->work);
+  MutexUnlock(&f->mutex);
+  PyThread_acquire_lock(f->done, WAIT_LOCK);
+  PyThread_release_lock(f->done);
+  error = f->error;
+  if (!error && f->sync) error = Sync(f->fd);
+  if (f->closefd && close(f->fd) != 0 && !error) error = errno;
+  Py_END_ALLOW_THREADS
+  FreeFlusher(f);
+  return error;
+}
+
+int
+FastCSV_OpenForWrite(PyObject *path, unsigned char append) {
+  PyObject *encoded = NULL;
+  int fd, saved_errno;
+  const int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+#ifdef MS_WINDOWS
+  wchar_t *wpath;
+  if (!PyUnicode_FSDecoder(path, &encoded)) return -1;
+  wpath = PyUnicode_AsWideCharString(encoded, NULL);
+  Py_DECREF(encoded);
+  if (!wpath) return -1;
+  Py_BEGIN_ALLOW_THREADS
+  fd = _wopen(wpath, flags | O_BINARY | O_NOINHERIT, 0666);
+  saved_errno = errno;
+  Py_END_ALLOW_THREADS
+  PyMem_Free(wpath);
+#else
+  if (!PyUnicode_FSConverter(path, &encoded)) return -1;
+  Py_BEGIN_ALLOW_THREADS
+  fd = open(PyBytes_AS_STRING(encoded), flags | O_CLOEXEC, 0666);
+  saved_errno = errno;
+  Py_END_ALLOW_THREADS
+  Py_DECREF(encoded);
+#endif
+  if (fd < 0) {
+    errno = saved_errno;
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+  }
+  return fd;
+}
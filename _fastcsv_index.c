@@ -0,0 +1,314 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+#define INDEX_MAGIC "FCSVIDX1"
+#define INDEX_MAGIC_LEN 8
+/* The longest LEB128 encoding of a 64-bit value. */
+#define MAX_VARINT_LEN 10
+
+/* Support function: OpenFile
+   Opens the file at path with the stdio mode. Returns NULL with OSError on
+   failure.
+ */
+static FILE *
+OpenFile(PyObject *path, const char *mode) {
+  PyObject *encoded = NULL;
+  FILE *file;
+  int saved_errno;
+#ifdef MS_WINDOWS
+  wchar_t *wpath;
+  wchar_t wmode[4];
+  Py_ssize_t i;
+  if (!PyUnicode_FSDecoder(path, &encoded)) return NULL;
+  wpath = PyUnicode_AsWideCharString(encoded, NULL);
+  if (!wpath) {
+    Py_DECREF(encoded);
+    return NULL;
+  }
+  for (i = 0; mode[i] && i < 3; i++) wmode[i] = mode[i];
+  wmode[i] = 0;
+  Py_BEGIN_ALLOW_THREADS
+  file = _wfopen(wpath, wmode);
+  saved_errno = errno;
+  Py_END_ALLOW_THREADS
+  PyMem_Free(wpath);
+#else
+  if (!PyUnicode_FSConverter(path, &encoded)) return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  file = fopen(PyBytes_AS_STRING(encoded), mode);
+  saved_errno = errno;
+  Py_END_ALLOW_THREADS
+#endif
+  if (!file) {
+    errno = saved_errno;
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+  }
+  Py_DECREF(encoded);
+  return file;
+}
+
+static char *
+PutVarint(char *p, unsigned long long value) {
+  while (value >= 0x80) {
+    *p++ = (char)(value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  *p++ = (char)value;
+  return p;
+}
+
+/* Support function: GetVarint
+   Decodes a value in [*pp, end) and advances *pp. Returns 0 if the data is
+   truncated or the value does not fit in Py_ssize_t.
+ */
+static int
+GetVarint(const char **pp, const char *end, Py_ssize_t *pvalue) {
+  const char *p = *pp;
+  unsigned long long value = 0;
+  int shift = 0;
+  for (; p < end && shift < 64; shift += 7) {
+    const unsigned char c = (unsigned char)*p++;
+    value |= (unsigned long long)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      if (value > (unsigned long long)PY_SSIZE_T_MAX) return 0;
+      *pp = p;
+      *pvalue = (Py_ssize_t)value;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int
+FastCSV_BuildIndex(const FastCSV_Parser *config, const char *data,
+                   Py_ssize_t size, Py_ssize_t start, FastCSV_Index *index)
+{
+  FastCSV_Parser parser;
+  FastCSV_ParseResult result = PARSE_END;
+  Py_ssize_t record_count = 0, cap = 0, count = 0;
+  Py_ssize_t *offsets = NULL;
+  unsigned char no_memory = 0;
+
+  memset(&parser, 0, sizeof(parser));
+  FastCSV_InitParser(&parser, config->newline_mode);
+  /* Only the first cell of a record is kept, and the rest is skipped by
+     the structural scan. */
+  parser.span_limit = 1;
+  parser.buf.data = (char *)data;
+  parser.buf_len = size;
+  parser.buf_pos = start;
+  parser.eof = 1;
+  FastCSV_ResetParser(&parser);
+
+  Py_BEGIN_ALLOW_THREADS
+  while (size > start) {
+    const Py_ssize_t record_start = parser.buf_pos;
+    result = FastCSV_ParseRecord(&parser);
+    if (result != PARSE_RECORD) break;
+    if (record_count && record_count % index->every == 0) {
+      if (count == cap) {
+        Py_ssize_t *grown;
+        cap = cap ? cap * 2 : 256;
+        grown = realloc(offsets, cap * sizeof(*offsets));
+        if (!grown) {
+          no_memory = 1;
+          break;
+        }
+        offsets = grown;
+      }
+      offsets[count++] = record_start;
+    }
+    record_count++;
+    parser.span_count = 0;
+    parser.buf_pos = parser.scan_pos;
+  }
+  Py_END_ALLOW_THREADS
+
+  FastCSV_FreeParser(&parser);
+  if (no_memory || result == PARSE_ERROR) {
+    free(offsets);
+    if (no_memory) {
+      PyErr_NoMemory();
+    } else {
+      PyErr_SetString(parser.error_type, parser.error);
+    }
+    return 0;
+  }
+  index->newline_mode = config->newline_mode;
+  index->file_size = size;
+  index->record_count = record_count;
+  index->offset_count = count;
+  index->offsets = offsets;
+  return 1;
+}
+
+int
+FastCSV_WriteIndex(PyObject *path, const FastCSV_Index *index) {
+  char *data, *p;
+  Py_ssize_t i, prev = 0;
+  size_t written;
+  FILE *file;
+  int closed;
+
+  if (index->offset_count > (PY_SSIZE_T_MAX - INDEX_MAGIC_LEN) /
+                            MAX_VARINT_LEN - 5) {
+    PyErr_NoMemory();
+    return 0;
+  }
+  data = PyMem_Malloc(INDEX_MAGIC_LEN +
+                      (index->offset_count + 5) * MAX_VARINT_LEN);
+  if (!data) {
+    PyErr_NoMemory();
+    return 0;
+  }
+  memcpy(data, INDEX_MAGIC, INDEX_MAGIC_LEN);
+  p = data + INDEX_MAGIC_LEN;
+  p = PutVarint(p, index->newline_mode);
+  p = PutVarint(p, index->every);
+  p = PutVarint(p, index->file_size);
+  p = PutVarint(p, index->record_count);
+  p = PutVarint(p, index->offset_count);
+  /* The offsets grow, so the deltas are small. */
+  for (i = 0; i < index->offset_count; i++) {
+    p = PutVarint(p, index->offsets[i] - prev);
+    prev = index->offsets[i];
+  }
+
+  file = OpenFile(path, "wb");
+  if (!file) {
+    PyMem_Free(data);
+    return 0;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  written = fwrite(data, 1, p - data, file);
+  closed = (fclose(file) == 0);
+  Py_END_ALLOW_THREADS
+  PyMem_Free(data);
+  if (written != (size_t)(p - data) || !closed) {
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+    return 0;
+  }
+  return 1;
+}
+
+int
+FastCSV_ReadIndex(PyObject *path, FastCSV_Index *index) {
+  FILE *file;
+  char *data = NULL;
+  const char *p, *end;
+  Py_ssize_t size = 0, cap = 4096, i, mode, prev = 0;
+  int failed;
+
+  file = OpenFile(path, "rb");
+  if (!file) return 0;
+  data = PyMem_Malloc(cap);
+  if (!data) {
+    fclose(file);
+    PyErr_NoMemory();
+    return 0;
+  }
+  for (;;) {
+    size_t n;
+    Py_BEGIN_ALLOW_THREADS
+    n = fread(data + size, 1, cap - size, file);
+    Py_END_ALLOW_THREADS
+    size += n;
+    if (size < cap) break;
+    if (cap > PY_SSIZE_T_MAX / 2) {
+      PyErr_NoMemory();
+      goto error_exit;
+    } else {
+      char *grown = PyMem_Realloc(data, cap * 2);
+      if (!grown) {
+        PyErr_NoMemory();
+        goto error_exit;
+      }
+      data = grown;
+      cap *= 2;
+    }
+  }
+  failed = ferror(file);
+  fclose(file);
+  file = NULL;
+  if (failed) {
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+    goto error_exit;
+  }
+
+  p = data + INDEX_MAGIC_LEN;
+  end = data + size;
+  if (size < INDEX_MAGIC_LEN || memcmp(data, INDEX_MAGIC, INDEX_MAGIC_LEN) ||
+      !GetVarint(&p, end, &mode) || mode > CRLF ||
+      !GetVarint(&p, end, &index->every) || index->every <= 0 ||
+      !GetVarint(&p, end, &index->file_size) ||
+      !GetVarint(&p, end, &index->record_count) ||
+      !GetVarint(&p, end, &index->offset_count) ||
+      index->offset_count > end - p) {
+    goto invalid;
+  }
+  index->newline_mode = (FastCSV_NewlineMode)mode;
+  index->offsets = malloc(sizeof(Py_ssize_t) *
+                          (index->offset_count ? index->offset_count : 1));
+  if (!index->offsets) {
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  for (i = 0; i < index->offset_count; i++) {
+    Py_ssize_t delta;
+    if (!GetVarint(&p, end, &delta) || delta > PY_SSIZE_T_MAX - prev ||
+        prev + delta > index->file_size) {
+      FastCSV_FreeIndex(index);
+      goto invalid;
+    }
+    prev += delta;
+    index->offsets[i] = prev;
+  }
+  if (p != end) {
+    FastCSV_FreeIndex(index);
+    goto invalid;
+  }
+  PyMem_Free(data);
+  return 1;
+
+invalid:
+  PyErr_Format(PyExc_ValueError, "%R is not a valid index file", path);
+error_exit:
+  if (file) fclose(file);
+  PyMem_Free(data);
+  return 0;
+}
+
+void
+FastCSV_FreeIndex(FastCSV_Index *index) {
+  /* The offsets are allocated without the GIL. */
+  free(index->offsets);
+  index->offsets = NULL;
+  index->offset_count = 0;
+}
@@ -0,0 +1,165 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+/* Intern tables of Reader. A table is an open addressing hash table keyed
+   on the raw characters of a cell. */
+
+#define INITIAL_SLOTS 16
+
+void
+FastCSV_InitIntern(FastCSV_InternTable *table, Py_ssize_t limit) {
+  table->limit = limit;
+  table->count = 0;
+  table->slot_count = 0;
+  table->slots = NULL;
+  table->hits = 0;
+  table->misses = 0;
+}
+
+void
+FastCSV_ClearIntern(FastCSV_InternTable *table) {
+  Py_ssize_t i;
+  for (i = 0; i < table->slot_count; i++) {
+    FastCSV_InternEntry *entry = &table->slots[i];
+    if (!entry->value) continue;
+    PyMem_Free(entry->key);
+    Py_DECREF(entry->value);
+  }
+  if (table->slots) PyMem_Del(table->slots);
+  FastCSV_InitIntern(table, table->limit);
+}
+
+/* Support function: HashKey
+   FNV-1a over the bytes of the key, mixed with the kind.
+ */
+static Py_hash_t
+HashKey(int kind, const char *key, Py_ssize_t key_size) {
+  size_t hash = 2166136261U ^ (size_t)kind;
+  Py_ssize_t i;
+  for (i = 0; i < key_size; i++) {
+    hash = (hash ^ (unsigned char)key[i]) * 16777619U;
+  }
+  return (Py_hash_t)hash;
+}
+
+/* Support function: FindSlot
+   Returns the slot of the key, or the empty slot where it should be added.
+ */
+static FastCSV_InternEntry *
+FindSlot(const FastCSV_InternTable *table, Py_hash_t hash, int kind,
+         const char *key, Py_ssize_t key_size)
+{
+  const size_t mask = (size_t)table->slot_count - 1;
+  size_t i = (size_t)hash & mask;
+  for (;; i = (i + 1) & mask) {
+    FastCSV_InternEntry *entry = &table->slots[i];
+    if (!entry->value) return entry;
+    if (entry->hash == hash && entry->kind == kind &&
+        entry->key_size == key_size &&
+        memcmp(entry->key, key, key_size) == 0) {
+      return entry;
+    }
+  }
+}
+
+/* Support function: Grow
+   Doubles the slots so that at most half of them are used.
+ */
+static unsigned char
+Grow(FastCSV_InternTable *table) {
+  const Py_ssize_t old_count = table->slot_count;
+  FastCSV_InternEntry *old_slots = table->slots;
+  Py_ssize_t i;
+
+  table->slot_count = old_count ? old_count * 2 : INITIAL_SLOTS;
+  table->slots = PyMem_New(FastCSV_InternEntry, table->slot_count);
+  if (!table->slots) {
+    table->slots = old_slots;
+    table->slot_count = old_count;
+    PyErr_NoMemory();
+    return 0;
+  }
+  memset(table->slots, 0, sizeof(FastCSV_InternEntry) * table->slot_count);
+  for (i = 0; i < old_count; i++) {
+    const FastCSV_InternEntry *entry = &old_slots[i];
+    if (!entry->value) continue;
+    *FindSlot(table, entry->hash, entry->kind, entry->key,
+              entry->key_size) = *entry;
+  }
+  if (old_slots) PyMem_Del(old_slots);
+  return 1;
+}
+
+PyObject *
+FastCSV_InternLookup(FastCSV_InternTable *table, int kind, const char *data,
+                     Py_ssize_t size, Py_hash_t *phash)
+{
+  const Py_ssize_t key_size = size * kind;
+  FastCSV_InternEntry *entry;
+
+  *phash = HashKey(kind, data, key_size);
+  if (table->slot_count) {
+    entry = FindSlot(table, *phash, kind, data, key_size);
+    if (entry->value) {
+      table->hits++;
+      Py_INCREF(entry->value);
+      return entry->value;
+    }
+  }
+  table->misses++;
+  return NULL;
+}
+
+int
+FastCSV_InternAdd(FastCSV_InternTable *table, Py_hash_t hash, int kind,
+                  const char *data, Py_ssize_t size, PyObject *value)
+{
+  const Py_ssize_t key_size = size * kind;
+  FastCSV_InternEntry *entry;
+  char *key;
+
+  if (table->count >= table->limit || key_size > FASTCSV_INTERN_MAX_KEY) {
+    return 1;
+  }
+  if ((table->count + 1) * 2 > table->slot_count && !Grow(table)) return 0;
+  /* Allocate one byte at least, since NULL means an error. */
+  key = PyMem_Malloc(key_size ? key_size : 1);
+  if (!key) {
+    PyErr_NoMemory();
+    return 0;
+  }
+  memcpy(key, data, key_size);
+  entry = FindSlot(table, hash, kind, data, key_size);
+  entry->hash = hash;
+  entry->kind = kind;
+  entry->key_size = key_size;
+  entry->key = key;
+  Py_INCREF(value);
+  entry->value = value;
+  table->count++;
+  return 1;
+}
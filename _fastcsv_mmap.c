@@ -0,0 +1,142 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+#ifdef MS_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Maps the whole file at path read-only. An empty file is mapped to
+   data == NULL and size == 0. Returns 0 with OSError on failure. */
+int
+FastCSV_MapFile(PyObject *path, FastCSV_Mapping *map) {
+  PyObject *encoded = NULL;
+  int ok = 0;
+  map->data = NULL;
+  map->size = 0;
+
+#ifdef MS_WINDOWS
+  {
+    HANDLE file;
+    LARGE_INTEGER size;
+    wchar_t *wpath;
+    if (!PyUnicode_FSDecoder(path, &encoded)) return 0;
+    wpath = PyUnicode_AsWideCharString(encoded, NULL);
+    if (!wpath) goto error_exit;
+    Py_BEGIN_ALLOW_THREADS
+    file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file != INVALID_HANDLE_VALUE) {
+      if (GetFileSizeEx(file, &size)) {
+        if (size.QuadPart == 0) {
+          ok = 1;
+        } else if (size.QuadPart <= PY_SSIZE_T_MAX) {
+          HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY,
+                                              0, 0, NULL);
+          if (mapping) {
+            map->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            map->size = (Py_ssize_t)size.QuadPart;
+            ok = (map->data != NULL);
+            CloseHandle(mapping);
+          }
+        }
+      }
+      CloseHandle(file);
+    }
+    Py_END_ALLOW_THREADS
+    PyMem_Free(wpath);
+    if (!ok) {
+      map->size = 0;
+      PyErr_SetExcFromWindowsErrWithFilenameObject(PyExc_OSError, 0,
+                                                   encoded);
+      goto error_exit;
+    }
+  }
+#else
+  {
+    int fd;
+    int saved_errno = EOVERFLOW;
+    struct stat st;
+    if (!PyUnicode_FSConverter(path, &encoded)) return 0;
+    Py_BEGIN_ALLOW_THREADS
+    fd = open(PyBytes_AS_STRING(encoded), O_RDONLY);
+    if (fd >= 0) {
+      if (fstat(fd, &st) == 0) {
+        if (st.st_size == 0) {
+          ok = 1;
+        } else if (st.st_size <= PY_SSIZE_T_MAX) {
+          void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (data != MAP_FAILED) {
+            map->data = data;
+            map->size = st.st_size;
+            /* The Reader reads the file only once from the head. Let the
+               kernel read ahead aggressively. */
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            ok = 1;
+          } else {
+            saved_errno = errno;
+          }
+        }
+      } else {
+        saved_errno = errno;
+      }
+      close(fd);
+    } else {
+      saved_errno = errno;
+    }
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+      errno = saved_errno;
+      PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+      goto error_exit;
+    }
+  }
+#endif
+
+  Py_DECREF(encoded);
+  return 1;
+error_exit:
+  Py_XDECREF(encoded);
+  return 0;
+}
+
+void
+FastCSV_UnmapFile(FastCSV_Mapping *map) {
+  if (map->data) {
+#ifdef MS_WINDOWS
+    UnmapViewOfFile(map->data);
+#else
+    munmap(map->data, map->size);
+#endif
+  }
+  map->data = NULL;
+  map->size = 0;
+}
@@ -0,0 +1,279 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+#include <stdlib.h>
+#include "pythread.h"
+
+typedef void (*TaskFunc)(void *arg);
+
+typedef struct {
+  TaskFunc func;
+  void *arg;
+  PyThread_type_lock done;
+} Task;
+
+static void
+RunTask(void *arg) {
+  Task *task = (Task *)arg;
+  task->func(task->arg);
+  PyThread_release_lock(task->done);
+}
+
+/* Support function: RunTasks
+   Calls func(args + i * arg_size) for every i < count on worker threads,
+   and waits for all of them. The first one runs on the calling thread. The
+   GIL is released while waiting, so func must not touch Python objects. A
+   task runs on the calling thread if a thread cannot be started.
+ */
+static int
+RunTasks(TaskFunc func, void *args, size_t arg_size, Py_ssize_t count) {
+  Task *tasks;
+  Py_ssize_t i;
+
+  tasks = PyMem_New(Task, count);
+  if (!tasks) {
+    PyErr_NoMemory();
+    return 0;
+  }
+  for (i = 0; i < count; i++) {
+    tasks[i].func = func;
+    tasks[i].arg = (char *)args + i * arg_size;
+    tasks[i].done = NULL;
+    if (i == 0) continue;
+    tasks[i].done = PyThread_allocate_lock();
+    if (!tasks[i].done) continue;
+    PyThread_acquire_lock(tasks[i].done, WAIT_LOCK);
+    if (PyThread_start_new_thread(RunTask, &tasks[i]) == (unsigned long)-1) {
+      PyThread_release_lock(tasks[i].done);
+      PyThread_free_lock(tasks[i].done);
+      tasks[i].done = NULL;
+    }
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  for (i = 0; i < count; i++) {
+    if (!tasks[i].done) func(tasks[i].arg);
+  }
+  for (i = 0; i < count; i++) {
+    if (tasks[i].done) {
+      PyThread_acquire_lock(tasks[i].done, WAIT_LOCK);
+      PyThread_release_lock(tasks[i].done);
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  for (i = 0; i < count; i++) {
+    if (tasks[i].done) PyThread_free_lock(tasks[i].done);
+  }
+  PyMem_Del(tasks);
+  return 1;
+}
+
+typedef struct {
+  const char *data;
+  Py_ssize_t size;
+  Py_ssize_t start, end;
+  FastCSV_NewlineMode newline_mode;
+  /* Results of the first pass. first_lineending[p] is the position after
+     the first lineending that follows an even (p = 0) or odd (p = 1) number
+     of quotes in the chunk, or -1. */
+  Py_ssize_t quotes;
+  Py_ssize_t first_lineending[2];
+} Chunk;
+
+/* Support function: ScanChunk
+   The first pass. Counts the quotes in the chunk and finds the first
+   lineending for each parity.
+ */
+static void
+ScanChunk(void *arg) {
+  Chunk *chunk = (Chunk *)arg;
+  const char *data = chunk->data;
+  const FastCSV_FindFunc find = fastcsv_scanner->find[0];
+  FastCSV_CharSet all_set, quote_set;
+  const FastCSV_CharSet *set = &all_set;
+  Py_ssize_t pos = chunk->start;
+  Py_ssize_t found = 0;
+
+  FastCSV_InitCharSet(&all_set, "\"\r\n");
+  FastCSV_InitCharSet(&quote_set, "\"");
+  chunk->quotes = 0;
+  chunk->first_lineending[0] = chunk->first_lineending[1] = -1;
+
+  while ((pos = find(data, pos, chunk->end, set)) < chunk->end) {
+    const char c = data[pos];
+    unsigned char lineending = 0;
+    if (c == '"') {
+      chunk->quotes++;
+    } else if (c == '\n') {
+      switch (chunk->newline_mode) {
+        case UniversalNewline:
+        case LF:
+          lineending = 1;
+          break;
+        case CRLF:
+          lineending = (pos > 0 && data[pos - 1] == '\r');
+          break;
+        case CR:
+          break;
+      }
+    } else {
+      switch (chunk->newline_mode) {
+        case UniversalNewline:
+          lineending = (pos + 1 == chunk->size || data[pos + 1] != '\n');
+          break;
+        case CR:
+          lineending = 1;
+          break;
+        case LF:
+        case CRLF:
+          break;
+      }
+    }
+    pos++;
+    if (lineending && chunk->first_lineending[chunk->quotes & 1] < 0) {
+      chunk->first_lineending[chunk->quotes & 1] = pos;
+      /* Only the quotes matter after both are found. */
+      if (++found == 2) set = &quote_set;
+    }
+  }
+}
+
+/* Support function: ParseRange
+   The second pass. Parses the records that begin in the range.
+ */
+static void
+ParseRange(void *arg) {
+  FastCSV_Range *range = (FastCSV_Range *)arg;
+  FastCSV_Parser *parser = &range->parser;
+
+  range->record_count = 0;
+  range->failed = 0;
+  parser->buf_pos = range->start;
+  FastCSV_ResetParser(parser);
+  while (parser->scan_pos < range->end) {
+    switch (FastCSV_ParseRecord(parser)) {
+      case PARSE_RECORD:
+        if (range->record_count == range->record_cap) {
+          Py_ssize_t cap = range->record_cap ? range->record_cap * 2 : 256;
+          Py_ssize_t *ends = realloc(range->record_ends, cap * sizeof(*ends));
+          if (!ends) {
+            parser->error_type = PyExc_MemoryError;
+            parser->error = "out of memory";
+            range->failed = 1;
+            return;
+          }
+          range->record_ends = ends;
+          range->record_cap = cap;
+        }
+        range->record_ends[range->record_count++] = parser->span_count;
+        parser->span_base = parser->span_count;
+        parser->buf_pos = parser->scan_pos;
+        break;
+
+      case PARSE_ERROR:
+        range->failed = 1;
+        return;
+
+      case PARSE_END:
+      case PARSE_NEED_MORE:
+        return;
+    }
+  }
+}
+
+Py_ssize_t
+FastCSV_ParseParallel(const char *data, Py_ssize_t size,
+                      Py_ssize_t start, Py_ssize_t chunk_size,
+                      const FastCSV_Parser *config,
+                      FastCSV_Range *ranges, Py_ssize_t threads)
+{
+  const FastCSV_NewlineMode newline_mode = config->newline_mode;
+  Chunk *chunks;
+  Py_ssize_t chunk_count, range_count, i;
+  unsigned char parity = 0;
+
+  chunk_count = (size - start + chunk_size - 1) / chunk_size;
+  if (chunk_count > threads) chunk_count = threads;
+  if (chunk_count < 1) chunk_count = 1;
+
+  chunks = PyMem_New(Chunk, chunk_count);
+  if (!chunks) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  for (i = 0; i < chunk_count; i++) {
+    chunks[i].data = data;
+    chunks[i].size = size;
+    chunks[i].start = start + i * chunk_size;
+    chunks[i].end = start + (i + 1) * chunk_size;
+    if (chunks[i].end > size) chunks[i].end = size;
+    chunks[i].newline_mode = newline_mode;
+  }
+  if (chunk_count > 1 &&
+      !RunTasks(ScanChunk, chunks, sizeof(Chunk), chunk_count)) {
+    PyMem_Del(chunks);
+    return -1;
+  }
+
+  /* Resolve the quote parity at the beginning of every chunk. */
+  ranges[0].start = start;
+  range_count = 1;
+  for (i = 1; i < chunk_count; i++) {
+    Py_ssize_t begin;
+    parity ^= (chunks[i - 1].quotes & 1);
+    begin = chunks[i].first_lineending[parity];
+    if (begin >= 0) ranges[range_count++].start = begin;
+  }
+  for (i = 0; i < range_count; i++) {
+    FastCSV_Parser *parser = &ranges[i].parser;
+    ranges[i].end = (i + 1 < range_count) ? ranges[i + 1].start
+                                          : chunks[chunk_count - 1].end;
+    FastCSV_InitParser(parser, newline_mode);
+    parser->span_limit = config->span_limit;
+    parser->buf.data = (char *)data;
+    parser->buf_len = size;
+    parser->eof = 1;
+  }
+  PyMem_Del(chunks);
+
+  if (!RunTasks(ParseRange, ranges, sizeof(FastCSV_Range), range_count)) {
+    return -1;
+  }
+  return range_count;
+}
+
+void
+FastCSV_FreeRanges(FastCSV_Range *ranges, Py_ssize_t count) {
+  Py_ssize_t i;
+  for (i = 0; i < count; i++) {
+    FastCSV_FreeParser(&ranges[i].parser);
+    free(ranges[i].record_ends);
+    ranges[i].record_ends = NULL;
+    ranges[i].record_cap = 0;
+  }
+}
@@ -0,0 +1,351 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+#include <stdlib.h>
+
+typedef enum {
+  SEE_SPLITTER,
+  SEE_LINEENDING,
+  SEE_QUOTE,
+  SEE_EOL,
+  SEE_CR_EOL,
+} BreakReason;
+
+#define CHAR_T Py_UCS1
+#define SEEK_NAME Seek_ucs1
+#include "_fastcsv_seek.h"
+#define CHAR_T Py_UCS2
+#define SEEK_NAME Seek_ucs2
+#include "_fastcsv_seek.h"
+#define CHAR_T Py_UCS4
+#define SEEK_NAME Seek_ucs4
+#include "_fastcsv_seek.h"
+
+void
+FastCSV_InitParser(FastCSV_Parser *parser, FastCSV_NewlineMode newline_mode) {
+  parser->newline_mode = newline_mode;
+  FastCSV_InitCharSet(&parser->quote_set, "\"");
+  switch (newline_mode) {
+    case UniversalNewline:
+      FastCSV_InitCharSet(&parser->skip_set, "\"\r\n");
+      FastCSV_InitCharSet(&parser->cell_set, "\",\r\n");
+      break;
+    case LF:
+      FastCSV_InitCharSet(&parser->skip_set, "\"\n");
+      FastCSV_InitCharSet(&parser->cell_set, "\",\n");
+      break;
+    case CR:
+    case CRLF:
+      FastCSV_InitCharSet(&parser->skip_set, "\"\r");
+      FastCSV_InitCharSet(&parser->cell_set, "\",\r");
+      break;
+  }
+  parser->span_limit = 0;
+  parser->buf_kind = PyUnicode_1BYTE_KIND;
+  parser->buf_len = 0;
+  parser->buf_pos = 0;
+  parser->eof = 0;
+  parser->error_type = NULL;
+  parser->error = NULL;
+  FastCSV_ResetParser(parser);
+}
+
+void
+FastCSV_FreeParser(FastCSV_Parser *parser) {
+  /* The spans are allocated without the GIL. */
+  free(parser->spans);
+  parser->spans = NULL;
+  parser->span_cap = 0;
+  parser->span_count = parser->span_base = 0;
+}
+
+void
+FastCSV_ResetParser(FastCSV_Parser *parser) {
+  parser->state = EXPECT_CELL;
+  parser->scan_pos = parser->buf_pos;
+  parser->skip_lf = 0;
+  parser->span_count = parser->span_base = 0;
+}
+
+void
+FastCSV_CompactParser(FastCSV_Parser *parser) {
+  const Py_ssize_t shift = parser->buf_pos;
+  Py_ssize_t i;
+  if (shift == 0) return;
+  memmove(parser->buf.data, parser->buf.data + shift * parser->buf_kind,
+          (parser->buf_len - shift) * parser->buf_kind);
+  parser->buf_len -= shift;
+  parser->buf_pos = 0;
+  parser->scan_pos -= shift;
+  parser->cell_start -= shift;
+  parser->quote_end -= shift;
+  for (i = 0; i < parser->span_count; i++) {
+    parser->spans[i].start -= shift;
+    parser->spans[i].end -= shift;
+  }
+}
+
+/* Support function: Seek
+   Scans the buffer from *pcurr and returns the break reason. It finds
+   splitter(',') or lineending or quote('"'), and stores the position of the
+   found char into *pcurr and the number of chars to skip into *pskip.
+   The scanning is done by the kernel specialized for the kind of the buffer.
+   It stops only at the characters in set.
+ */
+static BreakReason
+Seek(FastCSV_Parser *parser, Py_ssize_t *pcurr, Py_ssize_t *pskip,
+     const FastCSV_CharSet *set)
+{
+  const int kind = parser->buf_kind;
+  const FastCSV_FindFunc find =
+    fastcsv_scanner->find[FASTCSV_KIND_INDEX(kind)];
+  BreakReason reason;
+
+  switch (kind) {
+    case PyUnicode_1BYTE_KIND:
+      reason = Seek_ucs1(parser->buf.data, pcurr, parser->buf_len,
+                         parser->newline_mode, find, set, pskip);
+      break;
+    case PyUnicode_2BYTE_KIND:
+      reason = Seek_ucs2(parser->buf.data, pcurr, parser->buf_len,
+                         parser->newline_mode, find, set, pskip);
+      break;
+    default:
+      reason = Seek_ucs4(parser->buf.data, pcurr, parser->buf_len,
+                         parser->newline_mode, find, set, pskip);
+      break;
+  }
+  /* In CRLF mode, \r at the end of the buffer is a lineending only if no
+     more data comes. Otherwise stop at it, and look at it again with the
+     next data. */
+  if (reason == SEE_CR_EOL && parser->newline_mode == CRLF && !parser->eof) {
+    reason = SEE_EOL;
+  }
+  return reason;
+}
+
+#define BUF_READ(parser, i) \
+  PyUnicode_READ((parser)->buf_kind, (parser)->buf.data, (i))
+
+#define REACHED_LIMIT(parser) \
+  ((parser)->span_limit > 0 && \
+   (parser)->span_count - (parser)->span_base >= (parser)->span_limit)
+
+/* Support function: AddSpan
+   Appends the current cell ending at end to the spans.
+ */
+static unsigned char
+AddSpan(FastCSV_Parser *parser, Py_ssize_t end) {
+  FastCSV_CellSpan *span;
+  if (parser->span_count == parser->span_cap) {
+    Py_ssize_t cap = parser->span_cap ? parser->span_cap * 2 : 256;
+    FastCSV_CellSpan *spans = realloc(parser->spans, cap * sizeof(*spans));
+    if (!spans) return 0;
+    parser->spans = spans;
+    parser->span_cap = cap;
+  }
+  span = &parser->spans[parser->span_count++];
+  span->start = parser->cell_start;
+  span->end = end;
+  span->flags = parser->cell_flags;
+  return 1;
+}
+
+/* Runs the state machine from scan_pos until the end of a record or the end
+   of the buffer. On PARSE_RECORD, the spans of the record are added and
+   scan_pos points to the beginning of the next record. On PARSE_NEED_MORE,
+   the parsing can be resumed after more data is appended to the buffer. On
+   PARSE_ERROR, the broken record is dropped and the parsing resumes from the
+   character after the error. */
+FastCSV_ParseResult
+FastCSV_ParseRecord(FastCSV_Parser *parser) {
+  Py_ssize_t pos = parser->scan_pos;
+  Py_ssize_t skip;
+  BreakReason reason;
+
+  while (1) {
+    switch (parser->state) {
+      case EXPECT_CELL:
+        if (parser->skip_lf && pos < parser->buf_len) {
+          /* The previous record ended with CR at the end of the data. */
+          parser->skip_lf = 0;
+          if (BUF_READ(parser, pos) == '\n') {
+            parser->buf_pos = ++pos;
+          }
+        }
+        if (pos == parser->buf_len) goto need_more;
+        parser->cell_flags = 0;
+        if (BUF_READ(parser, pos) == '"') {
+          parser->cell_flags = FASTCSV_CELL_QUOTED;
+          parser->cell_start = ++pos;
+          parser->state = IN_QUOTE;
+        } else {
+          parser->cell_start = pos;
+          parser->state = IN_CELL;
+        }
+        break;
+
+      case IN_CELL:
+        reason = Seek(parser, &pos, &skip, &parser->cell_set);
+        switch (reason) {
+          case SEE_EOL:
+            goto need_more;
+
+          case SEE_QUOTE:
+            parser->error_type = PyExc_ValueError;
+            parser->error = "string before quote";
+            pos++;
+            goto error;
+
+          case SEE_SPLITTER:
+          case SEE_LINEENDING:
+          case SEE_CR_EOL:
+            if (!AddSpan(parser, pos)) goto no_memory;
+            pos += skip;
+            parser->state = EXPECT_CELL;
+            if (reason == SEE_SPLITTER) {
+              if (REACHED_LIMIT(parser)) parser->state = SKIP_REST;
+              break;
+            }
+            parser->skip_lf = (reason == SEE_CR_EOL);
+            goto record;
+        }
+        break;
+
+      case IN_QUOTE:
+        reason = Seek(parser, &pos, &skip, &parser->quote_set);
+        if (reason == SEE_EOL) goto need_more;
+        parser->quote_end = pos++;
+        parser->state = OUT_QUOTE;
+        break;
+
+      case OUT_QUOTE:
+        if (pos == parser->buf_len) goto need_more;
+        if (BUF_READ(parser, pos) == '"') {
+          parser->cell_flags |= FASTCSV_CELL_ESCAPED;
+          pos++;
+          parser->state = IN_QUOTE;
+          break;
+        }
+        {
+          Py_ssize_t found = pos;
+          reason = Seek(parser, &found, &skip, &parser->cell_set);
+          if (reason == SEE_EOL) goto need_more;
+          if (found != pos || reason == SEE_QUOTE) {
+            parser->error_type = PyExc_ValueError;
+            parser->error = "string after quote";
+            pos = found;
+            goto error;
+          }
+        }
+        if (!AddSpan(parser, parser->quote_end)) goto no_memory;
+        pos += skip;
+        parser->state = EXPECT_CELL;
+        if (reason == SEE_SPLITTER) {
+          if (REACHED_LIMIT(parser)) parser->state = SKIP_REST;
+          break;
+        }
+        parser->skip_lf = (reason == SEE_CR_EOL);
+        goto record;
+
+      case SKIP_REST:
+        reason = Seek(parser, &pos, &skip, &parser->skip_set);
+        if (reason == SEE_EOL) goto need_more;
+        pos += skip;
+        if (reason == SEE_QUOTE) {
+          parser->state = SKIP_QUOTE;
+          break;
+        }
+        parser->state = EXPECT_CELL;
+        parser->skip_lf = (reason == SEE_CR_EOL);
+        goto record;
+
+      case SKIP_QUOTE:
+        /* A doubled quote leaves and enters the quoted cell again. */
+        reason = Seek(parser, &pos, &skip, &parser->quote_set);
+        if (reason == SEE_EOL) goto need_more;
+        pos++;
+        parser->state = SKIP_REST;
+        break;
+    }
+  }
+
+record:
+  parser->scan_pos = pos;
+  return PARSE_RECORD;
+
+need_more:
+  parser->scan_pos = pos;
+  if (!parser->eof) return PARSE_NEED_MORE;
+  if (parser->state == EXPECT_CELL &&
+      parser->span_count == parser->span_base && parser->buf_pos == pos) {
+    return PARSE_END;
+  }
+  parser->error_type = PyExc_IOError;
+  parser->error = "unexpected end of data";
+  goto error;
+
+no_memory:
+  parser->error_type = PyExc_MemoryError;
+  parser->error = "out of memory";
+  goto error;
+
+error:
+  /* Drop the broken record and resume from the next character. */
+  parser->state = EXPECT_CELL;
+  parser->span_count = parser->span_base;
+  parser->scan_pos = parser->buf_pos = pos;
+  return PARSE_ERROR;
+}
+
+Py_ssize_t
+FastCSV_Unescape(int kind, const char *from, Py_ssize_t size, char *to) {
+  Py_ssize_t i, n = 0;
+  switch (kind) {
+#define UNESCAPE(CHAR_T) \
+    { \
+      const CHAR_T *src = (const CHAR_T *)from; \
+      CHAR_T *dst = (CHAR_T *)to; \
+      for (i = 0; i < size; i++) { \
+        dst[n++] = src[i]; \
+        /* Every quote in an escaped cell is doubled. */ \
+        if (src[i] == '"') i++; \
+      } \
+    }
+    case PyUnicode_1BYTE_KIND:
+      UNESCAPE(Py_UCS1);
+      break;
+    case PyUnicode_2BYTE_KIND:
+      UNESCAPE(Py_UCS2);
+      break;
+    default:
+      UNESCAPE(Py_UCS4);
+      break;
+#undef UNESCAPE
+  }
+  return n;
+}
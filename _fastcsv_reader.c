@@ -23,109 +23,587 @@
  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  }}} */
-#include <Python.h>
+#include "_fastcsv.h"
+
+#define DEFAULT_BUFFER_SIZE (256 * 1024)
+#define DEFAULT_CHUNK_SIZE (4 * 1024 * 1024)
+#define DEFAULT_INTERN_LIMIT 1024
+
+typedef enum {
+  ROW_LIST,
+  ROW_TUPLE,
+  /* A list, refilled in place if nobody else refers to it. */
+  ROW_REUSE,
+  /* A dict keyed by fieldnames. */
+  ROW_DICT,
+} RowType;
 
 typedef enum {
-  UniversalNewline,
-  LF,
-  CR,
-  CRLF,
-} NewlineMode;
+  PUSH_NONE,
+  /* Reader.feed has been called. The parser waits for more data instead
+     of reading. */
+  PUSH_FEEDING,
+  /* Reader.close has been called. */
+  PUSH_CLOSED,
+} PushState;
 
 typedef struct {
   PyObject_HEAD
   PyObject *fileobj;
-  PyObject *readbuf;
-  Py_ssize_t readbuf_start;
+  /* read or readinto of fileobj. NULL if there is no fileobj. */
+  PyObject *readfunc;
+  /* The file mapped by Reader.from_path. buf points to it while it is
+     mapped. */
+  FastCSV_Mapping map;
+  unsigned char use_readinto;
   unsigned char entered;
-  NewlineMode newline_mode;
+  /* In bytes mode, codec is not NULL and fileobj should be a binary file.
+     The cells are decoded from the raw bytes with codec. */
+  const FastCSV_Codec *codec;
+  PyObject *errors;
+  unsigned char bom_checked;
+  FastCSV_Buffer scratch;
+  /* Unescaped characters of the current cell. See MakeCell. */
+  FastCSV_Buffer cellbuf;
+
+  /* The parser and its buffer. A record that is not complete at the end of
+     the buffer is moved to the head of the buffer before the next read, and
+     the buffer grows to buf_chars characters if the record fills it. */
+  FastCSV_Parser parser;
+  Py_ssize_t buf_chars;
+  /* The offset of the head of the buffer in the stream, in the units of
+     the buffer. See Reader.tell. */
+  Py_ssize_t stream_base;
+  PushState push;
+
+  /* Parallel parsing of the mapped file. The records of ranges are
+     returned in order, and the next window begins at window_start. */
+  Py_ssize_t threads, chunk_size;
+  FastCSV_Range *ranges;
+  Py_ssize_t range_count, range_index, record_index;
+  Py_ssize_t window_start;
+  /* The offset of the first record after the BOM, and the index loaded by
+     Reader.from_path. index.every is 0 if there is no index. */
+  Py_ssize_t data_start;
+  FastCSV_Index index;
+
+  /* Types of the first schema_count columns. NULL if there is no
+     schema. */
+  FastCSV_Converter *schema;
+  Py_ssize_t schema_count;
+  /* The number of the records returned so far. */
+  Py_ssize_t row_num;
+  /* Indices of the selected columns, in the order of the cells of a row.
+     NULL if every column is selected. The names in usecol_names are not
+     resolved yet and their indices are -1. */
+  Py_ssize_t *usecols;
+  Py_ssize_t usecol_count;
+  PyObject *usecol_names;
+  /* A record is returned only if it matches every predicate. NULL if
+     there is no predicate. */
+  FastCSV_Predicate *where;
+  Py_ssize_t where_count;
+  /* Intern tables of the str cells, indexed by the column in the file. A
+     table whose limit is 0 is not used. With intern_all, a table is added
+     for every column when it first appears. The names in intern_names are
+     not resolved yet. */
+  FastCSV_InternTable *interns;
+  Py_ssize_t intern_count, intern_limit;
+  unsigned char intern_all;
+  PyObject *intern_names;
+  /* usecols, where or intern has a name that is resolved with the first
+     record. */
+  unsigned char names_pending;
+  /* The record returned by NextRecord is the header. Its cells are str
+     regardless of the schema, and are not interned. */
+  unsigned char header_record;
+
+  RowType row_type;
+  /* The last row of ROW_REUSE. */
+  PyObject *last_row;
+  /* Keys of ROW_DICT, and a dict that maps every key to restval. A row is
+     a copy of row_template, so that it is presized and never rehashed.
+     Both are NULL until the header is read. */
+  PyObject *fieldnames;
+  PyObject *row_template;
+  PyObject *restkey, *restval;
+  /* Rows are lazy rows. See FastCSV_LazyRow. */
+  unsigned char lazy;
 
   Py_ssize_t cell_cap;
   PyObject **cells;
-  Py_ssize_t content_cap;
-  PyObject **contents;
-
-  PyObject *read_string, *read_arg;
 } Reader;
 
 static unsigned char
-ParseNewlineMode(PyObject *newline, NewlineMode *newline_mode) {
+ParseNewlineMode(PyObject *newline, FastCSV_NewlineMode *newline_mode) {
   if (!newline || newline == Py_None) {
     *newline_mode = UniversalNewline;
   } else {
-    unsigned char free_newline = 0;
-#if PY_MAJOR_VERSION >= 3
-    // Do not do bytes to unicode conversion in Python3. We expect the caller to
-    // use unicode strings consistently in Python3.
-#else
-    if (PyString_Check(newline)) {
-      PyObject *decoded = PyUnicode_FromObject(newline);
-      if (!decoded) {
-        PyErr_SetString(PyExc_ValueError, "newline kwarg is invalid");
-        return 0;
-      }
-      free_newline = 1;
-      newline = decoded;
-    }
-#endif
-    if (PyUnicode_Check(newline)) {
-      if (PyUnicode_GET_SIZE(newline) == 1) {
-        if (PyUnicode_AS_UNICODE(newline)[0] == '\r') {
-          *newline_mode = CR;
-        } else if (PyUnicode_AS_UNICODE(newline)[0] == '\n') {
-          *newline_mode = LF;
-        } else {
-          PyErr_SetString(PyExc_ValueError, "newline kwarg is invalid");
-          return 0;
-        }
-      } else if (PyUnicode_GET_SIZE(newline) == 2 &&
-          PyUnicode_AS_UNICODE(newline)[0] == '\r' &&
-          PyUnicode_AS_UNICODE(newline)[1] == '\n') {
-        *newline_mode = CRLF;
+    // We expect the caller to use unicode strings consistently.
+    if (!PyUnicode_Check(newline) || FASTCSV_READY(newline) < 0) {
+      PyErr_SetString(PyExc_ValueError, "newline kwarg is invalid");
+      return 0;
+    }
+    if (PyUnicode_GET_LENGTH(newline) == 1) {
+      if (PyUnicode_READ_CHAR(newline, 0) == '\r') {
+        *newline_mode = CR;
+      } else if (PyUnicode_READ_CHAR(newline, 0) == '\n') {
+        *newline_mode = LF;
       } else {
         PyErr_SetString(PyExc_ValueError, "newline kwarg is invalid");
         return 0;
       }
+    } else if (PyUnicode_GET_LENGTH(newline) == 2 &&
+        PyUnicode_READ_CHAR(newline, 0) == '\r' &&
+        PyUnicode_READ_CHAR(newline, 1) == '\n') {
+      *newline_mode = CRLF;
+    } else {
+      PyErr_SetString(PyExc_ValueError, "newline kwarg is invalid");
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Support function: ReleaseMapping
+   Unmaps the file mapped by Reader.from_path, and leaves an empty buffer.
+ */
+static void
+ReleaseMapping(Reader *self) {
+  if (!self->map.data) return;
+  FastCSV_UnmapFile(&self->map);
+  self->parser.buf.data = NULL;
+  self->parser.buf.cap = 0;
+  self->parser.buf_len = self->parser.buf_pos = self->buf_chars = 0;
+  FastCSV_ResetParser(&self->parser);
+  self->range_count = 0;
+  self->window_start = 0;
+}
+
+/* Support function: SetSpanLimit
+   Lets the parser skip the cells after the last column that is selected or
+   checked by a predicate. Every cell is needed until the names are
+   resolved.
+ */
+static void
+SetSpanLimit(Reader *self) {
+  Py_ssize_t i, limit = 0;
+  if (!self->usecols || self->names_pending) {
+    self->parser.span_limit = 0;
+    return;
+  }
+  for (i = 0; i < self->usecol_count; i++) {
+    if (self->usecols[i] >= limit) limit = self->usecols[i] + 1;
+  }
+  for (i = 0; i < self->where_count; i++) {
+    if (self->where[i].column >= limit) limit = self->where[i].column + 1;
+  }
+  /* A limit of 0 means no limit. Keep one cell to find the records. */
+  self->parser.span_limit = limit ? limit : 1;
+}
+
+/* Support function: ParseUsecols
+   Takes the indices of the selected columns. A name is resolved later by
+   ResolveNames with the header.
+ */
+static unsigned char
+ParseUsecols(Reader *self, PyObject *usecols) {
+  PyObject *seq;
+  Py_ssize_t i, count;
+  unsigned char has_name = 0;
+
+  seq = PySequence_Fast(usecols, "usecols should be a sequence");
+  if (!seq) return 0;
+  count = PySequence_Fast_GET_SIZE(seq);
+  self->usecols = PyMem_New(Py_ssize_t, count ? count : 1);
+  if (!self->usecols) {
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  self->usecol_count = count;
+  for (i = 0; i < count; i++) {
+    PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+    if (PyUnicode_Check(item)) {
+      self->usecols[i] = -1;
+      has_name = 1;
+    } else {
+      self->usecols[i] = PyNumber_AsSsize_t(item, PyExc_OverflowError);
+      if (self->usecols[i] == -1 && PyErr_Occurred()) goto error_exit;
+      if (self->usecols[i] < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "usecols should not be negative");
+        goto error_exit;
+      }
     }
+  }
+  if (has_name) {
+    self->usecol_names = seq;
+    self->names_pending = 1;
+  } else {
+    Py_DECREF(seq);
+  }
+  return 1;
 
-    if (free_newline) {
-      Py_DECREF(newline);
+error_exit:
+  Py_DECREF(seq);
+  return 0;
+}
+
+/* Support function: ParseRowType
+   Takes list, tuple or "reuse". The names of the types are accepted too.
+ */
+static unsigned char
+ParseRowType(PyObject *row_type, RowType *ptype) {
+  if (!row_type || row_type == Py_None ||
+      row_type == (PyObject *)&PyList_Type) {
+    *ptype = ROW_LIST;
+    return 1;
+  } else if (row_type == (PyObject *)&PyTuple_Type) {
+    *ptype = ROW_TUPLE;
+    return 1;
+  } else if (row_type == (PyObject *)&PyDict_Type) {
+    *ptype = ROW_DICT;
+    return 1;
+  } else if (PyUnicode_Check(row_type)) {
+    if (PyUnicode_CompareWithASCIIString(row_type, "list") == 0) {
+      *ptype = ROW_LIST;
+      return 1;
+    } else if (PyUnicode_CompareWithASCIIString(row_type, "tuple") == 0) {
+      *ptype = ROW_TUPLE;
+      return 1;
+    } else if (PyUnicode_CompareWithASCIIString(row_type, "dict") == 0) {
+      *ptype = ROW_DICT;
+      return 1;
+    } else if (PyUnicode_CompareWithASCIIString(row_type, "reuse") == 0) {
+      *ptype = ROW_REUSE;
+      return 1;
     }
   }
+  PyErr_SetString(PyExc_ValueError,
+                  "row_type should be list, tuple, dict or 'reuse'");
+  return 0;
+}
+
+/* Support function: SetFieldnames
+   Takes the keys of the dict rows. The str keys are interned, so that
+   every row shares them and looking them up is fast.
+ */
+static unsigned char
+SetFieldnames(Reader *self, PyObject *fieldnames) {
+  PyObject *seq, *keys = NULL, *template = NULL;
+  Py_ssize_t i;
+
+  seq = PySequence_Fast(fieldnames, "fieldnames should be a sequence");
+  if (!seq) return 0;
+  keys = PyTuple_New(PySequence_Fast_GET_SIZE(seq));
+  if (!keys) goto error_exit;
+  template = PyDict_New();
+  if (!template) goto error_exit;
+  for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+    PyObject *key = PySequence_Fast_GET_ITEM(seq, i);
+    Py_INCREF(key);
+    if (PyUnicode_CheckExact(key)) PyUnicode_InternInPlace(&key);
+    PyTuple_SET_ITEM(keys, i, key);
+    if (PyDict_SetItem(template, key, self->restval) < 0) goto error_exit;
+  }
+  Py_DECREF(seq);
+  Py_XDECREF(self->fieldnames);
+  Py_XDECREF(self->row_template);
+  self->fieldnames = keys;
+  self->row_template = template;
   return 1;
+
+error_exit:
+  Py_DECREF(seq);
+  Py_XDECREF(keys);
+  Py_XDECREF(template);
+  return 0;
+}
+
+/* Support function: ClearInterns
+   Releases the intern tables.
+ */
+static void
+ClearInterns(Reader *self) {
+  Py_ssize_t i;
+  for (i = 0; i < self->intern_count; i++) {
+    FastCSV_ClearIntern(&self->interns[i]);
+  }
+  if (self->interns) PyMem_Del(self->interns);
+  self->interns = NULL;
+  self->intern_count = 0;
+  Py_CLEAR(self->intern_names);
+}
+
+/* Support function: ReserveInterns
+   Makes the tables of the columns before count. The new tables are used
+   if intern_all.
+ */
+static unsigned char
+ReserveInterns(Reader *self, Py_ssize_t count) {
+  FastCSV_InternTable *tmp = self->interns;
+  Py_ssize_t i;
+  if (count <= self->intern_count) return 1;
+  PyMem_Resize(tmp, FastCSV_InternTable, count);
+  if (!tmp) {
+    PyErr_NoMemory();
+    return 0;
+  }
+  self->interns = tmp;
+  for (i = self->intern_count; i < count; i++) {
+    FastCSV_InitIntern(&self->interns[i],
+                       self->intern_all ? self->intern_limit : 0);
+  }
+  self->intern_count = count;
+  return 1;
+}
+
+/* Support function: ParseIntern
+   Takes True or a sequence of the columns to intern. A name is resolved
+   later by ResolveNames with the header.
+ */
+static unsigned char
+ParseIntern(Reader *self, PyObject *intern) {
+  PyObject *seq;
+  Py_ssize_t i;
+  unsigned char has_name = 0;
+
+  if (PyBool_Check(intern)) {
+    self->intern_all = (intern == Py_True);
+    return 1;
+  }
+  seq = PySequence_Fast(intern, "intern should be True or a sequence");
+  if (!seq) return 0;
+  for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+    PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+    Py_ssize_t column;
+    if (PyUnicode_Check(item)) {
+      has_name = 1;
+      continue;
+    }
+    column = PyNumber_AsSsize_t(item, PyExc_OverflowError);
+    if (column == -1 && PyErr_Occurred()) goto error_exit;
+    if (column < 0) {
+      PyErr_SetString(PyExc_ValueError, "intern should not be negative");
+      goto error_exit;
+    }
+    if (!ReserveInterns(self, column + 1)) goto error_exit;
+    self->interns[column].limit = self->intern_limit;
+  }
+  if (has_name) {
+    self->intern_names = seq;
+    self->names_pending = 1;
+  } else {
+    Py_DECREF(seq);
+  }
+  return 1;
+
+error_exit:
+  Py_DECREF(seq);
+  return 0;
+}
+
+/* Support function: ParseCheckpoint
+   Parses a checkpoint returned by Reader.tell.
+ */
+static unsigned char
+ParseCheckpoint(PyObject *checkpoint, Py_ssize_t *poffset, Py_ssize_t *prow,
+                unsigned char *pskip_lf)
+{
+  int skip_lf;
+  if (!PyTuple_Check(checkpoint) ||
+      !PyArg_ParseTuple(checkpoint, "nnp", poffset, prow, &skip_lf)) {
+    if (!PyErr_Occurred() || PyErr_ExceptionMatches(PyExc_TypeError)) {
+      PyErr_Clear();
+      PyErr_SetString(PyExc_ValueError,
+                      "resume should be a checkpoint of Reader.tell");
+    }
+    return 0;
+  }
+  if (*poffset < 0 || *prow < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "resume should be a checkpoint of Reader.tell");
+    return 0;
+  }
+  *pskip_lf = (unsigned char)skip_lf;
+  return 1;
+}
+
+/* Support function: HeaderPending
+   Tells whether the next record is read as the header.
+ */
+static unsigned char
+HeaderPending(Reader *self) {
+  return self->names_pending || (self->row_type == ROW_DICT &&
+                                 !self->fieldnames);
 }
 
 static int
 Reader_init(Reader *self, PyObject *args, PyObject *kwds) {
-  static char *kwlist[] = {"fileobj", "newline",   NULL};
+  static char *kwlist[] = {"fileobj", "newline", "encoding", "errors",
+                           "buffer_size", "schema", "usecols", "where",
+                           "intern", "intern_limit", "row_type",
+                           "fieldnames", "restkey", "restval", "lazy",
+                           "resume", NULL};
   PyObject *fileobj = NULL;
   PyObject *newline = NULL;
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist,
+  PyObject *encoding = NULL;
+  PyObject *errors = NULL;
+  Py_ssize_t buffer_size = DEFAULT_BUFFER_SIZE;
+  PyObject *schema = NULL;
+  PyObject *usecols = NULL;
+  PyObject *where = NULL;
+  PyObject *intern = NULL;
+  Py_ssize_t intern_limit = DEFAULT_INTERN_LIMIT;
+  PyObject *row_type = NULL;
+  PyObject *fieldnames = NULL;
+  PyObject *restkey = Py_None;
+  PyObject *restval = Py_None;
+  int lazy = 0;
+  PyObject *resume = NULL;
+  FastCSV_NewlineMode newline_mode;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOOnOOOOnOOOOpO", kwlist,
                                    &fileobj,
-                                   &newline))
+                                   &newline,
+                                   &encoding,
+                                   &errors,
+                                   &buffer_size,
+                                   &schema,
+                                   &usecols,
+                                   &where,
+                                   &intern,
+                                   &intern_limit,
+                                   &row_type,
+                                   &fieldnames,
+                                   &restkey,
+                                   &restval,
+                                   &lazy,
+                                   &resume))
     goto error;
 
-  if (!ParseNewlineMode(newline, &(self->newline_mode))) goto error;
+  if (!ParseNewlineMode(newline, &newline_mode)) goto error;
+  if (!ParseRowType(row_type, &self->row_type)) goto error;
+  Py_CLEAR(self->last_row);
+  Py_CLEAR(self->fieldnames);
+  Py_CLEAR(self->row_template);
+  {
+    PyObject *tmp_key = self->restkey, *tmp_val = self->restval;
+    Py_INCREF(restkey);
+    Py_INCREF(restval);
+    self->restkey = restkey;
+    self->restval = restval;
+    Py_XDECREF(tmp_key);
+    Py_XDECREF(tmp_val);
+  }
+  self->lazy = (unsigned char)lazy;
+  if (lazy && (self->row_type != ROW_LIST ||
+               (schema && schema != Py_None) ||
+               (intern && intern != Py_None && intern != Py_False))) {
+    PyErr_SetString(PyExc_ValueError,
+                    "lazy rows support none of row_type, schema and intern");
+    goto error;
+  }
+  if (fieldnames && fieldnames != Py_None) {
+    if (self->row_type != ROW_DICT) {
+      PyErr_SetString(PyExc_ValueError,
+                      "fieldnames requires row_type=dict");
+      goto error;
+    }
+    if (!SetFieldnames(self, fieldnames)) goto error;
+  }
+  if (buffer_size <= 0) {
+    PyErr_SetString(PyExc_ValueError, "buffer_size should be positive");
+    goto error;
+  }
+
+  self->codec = NULL;
+  if (encoding && encoding != Py_None) {
+    self->codec = FastCSV_LookupCodec(encoding);
+    if (!self->codec) goto error;
+  }
+  if (errors && errors != Py_None) {
+    if (!PyUnicode_Check(errors)) {
+      PyErr_SetString(PyExc_TypeError, "errors should be str");
+      goto error;
+    }
+    Py_INCREF(errors);
+  } else {
+    errors = PyUnicode_FromString("strict");
+    if (!errors) goto error;
+  }
+  {
+    PyObject *tmp = self->errors;
+    self->errors = errors;
+    Py_XDECREF(tmp);
+  }
+  self->bom_checked = 0;
+
+  FastCSV_FreeSchema(self->schema, self->schema_count);
+  self->schema = NULL;
+  self->schema_count = 0;
+  if (schema && schema != Py_None) {
+    self->schema = FastCSV_ParseSchema(schema, &self->schema_count);
+    if (!self->schema) goto error;
+  }
+  self->row_num = 0;
+  self->stream_base = 0;
+  self->push = PUSH_NONE;
 
   self->cell_cap = 256;
   self->cells = PyMem_New(PyObject *, self->cell_cap);
   if (!self->cells) goto error;
-  self->content_cap = 8;
-  self->contents = PyMem_New(PyObject *, self->content_cap);
-  if (!self->contents) goto error;
-
-#if PY_MAJOR_VERSION >= 3
-  self->read_string = PyUnicode_FromString("read");
-#else
-  self->read_string = PyString_FromString("read");
-#endif
-  if (!self->read_string) goto error;
-  self->read_arg = PyLong_FromLong(1024);
-  if (!self->read_arg) goto error;
 
+  ReleaseMapping(self);
+  FastCSV_InitParser(&self->parser, newline_mode);
+  if (self->usecols) {
+    PyMem_Del(self->usecols);
+    self->usecols = NULL;
+  }
+  Py_CLEAR(self->usecol_names);
+  FastCSV_FreeWhere(self->where, self->where_count);
+  self->where = NULL;
+  self->where_count = 0;
+  self->names_pending = 0;
+  self->header_record = 0;
+  if (usecols && usecols != Py_None && !ParseUsecols(self, usecols)) {
+    goto error;
+  }
+  if (where && where != Py_None) {
+    Py_ssize_t i;
+    self->where = FastCSV_ParseWhere(
+        where, self->codec ? self->codec->fallback : NULL,
+        &self->where_count);
+    if (!self->where) goto error;
+    for (i = 0; i < self->where_count; i++) {
+      if (self->where[i].name) self->names_pending = 1;
+    }
+  }
+  ClearInterns(self);
+  self->intern_all = 0;
+  if (intern_limit < 0) {
+    PyErr_SetString(PyExc_ValueError, "intern_limit should not be negative");
+    goto error;
+  }
+  self->intern_limit = intern_limit;
+  if (intern && intern != Py_None && !ParseIntern(self, intern)) goto error;
+  SetSpanLimit(self);
+  self->buf_chars = buffer_size;
+  if (!FastCSV_BufferReserve(&self->parser.buf, buffer_size)) goto error;
   self->entered = 0;
-  self->readbuf = NULL;
-  self->readbuf_start = 0;
+
+  /* Binary files are read into the buffer directly by readinto. */
+  self->use_readinto = (self->codec != NULL &&
+                        PyObject_HasAttrString(fileobj, "readinto"));
+  {
+    PyObject *tmp = self->readfunc;
+    self->readfunc = NULL;
+    if (fileobj != Py_None) {
+      self->readfunc = PyObject_GetAttrString(
+          fileobj, self->use_readinto ? "readinto" : "read");
+    }
+    Py_XDECREF(tmp);
+    if (!self->readfunc && fileobj != Py_None) goto error;
+  }
 
   {
     PyObject *tmp = self->fileobj;
@@ -134,23 +612,70 @@ Reader_init(Reader *self, PyObject *args, PyObject *kwds) {
     Py_XDECREF(tmp);
   }
 
+  if (resume && resume != Py_None) {
+    /* Continue from the checkpoint in the same file. The file is seeked
+       by bytes, so only a binary file can be resumed. */
+    Py_ssize_t offset, row;
+    unsigned char skip_lf;
+    PyObject *ret;
+    if (!ParseCheckpoint(resume, &offset, &row, &skip_lf)) goto error;
+    if (!self->codec || fileobj == Py_None) {
+      PyErr_SetString(PyExc_ValueError,
+                      "resume requires a binary file and encoding");
+      goto error;
+    }
+    if (row > 0 && HeaderPending(self)) {
+      PyErr_SetString(PyExc_ValueError,
+                      "resume cannot read the header again; give usecols, "
+                      "where and intern by index and give fieldnames");
+      goto error;
+    }
+    ret = PyObject_CallMethod(fileobj, "seek", "n", offset);
+    if (!ret) goto error;
+    Py_DECREF(ret);
+    self->stream_base = offset;
+    self->row_num = row;
+    self->parser.skip_lf = skip_lf;
+    /* The BOM is only at the head of the file. */
+    if (offset > 0) self->bom_checked = 1;
+  }
+
   return 0;
 error:
-  Py_XDECREF(self->read_string);
-  Py_XDECREF(self->read_arg);
-  if (self->cells) PyMem_Del(self->cells);
-  if (self->contents) PyMem_Del(self->contents);
+  if (self->cells) {
+    PyMem_Del(self->cells);
+    self->cells = NULL;
+  }
   return -1;
 }
 
 static void
 Reader_dealloc(Reader *self) {
   Py_XDECREF(self->fileobj);
-  Py_XDECREF(self->readbuf);
-  Py_XDECREF(self->read_string);
-  Py_XDECREF(self->read_arg);
+  Py_XDECREF(self->readfunc);
+  Py_XDECREF(self->errors);
+  ReleaseMapping(self);
+  FastCSV_BufferFree(&self->scratch);
+  FastCSV_BufferFree(&self->cellbuf);
+  FastCSV_BufferFree(&self->parser.buf);
   if (self->cells) PyMem_Del(self->cells);
-  if (self->contents) PyMem_Del(self->contents);
+  FastCSV_FreeParser(&self->parser);
+  FastCSV_FreeSchema(self->schema, self->schema_count);
+  if (self->usecols) PyMem_Del(self->usecols);
+  Py_XDECREF(self->usecol_names);
+  FastCSV_FreeWhere(self->where, self->where_count);
+  ClearInterns(self);
+  Py_XDECREF(self->last_row);
+  Py_XDECREF(self->fieldnames);
+  Py_XDECREF(self->row_template);
+  Py_XDECREF(self->restkey);
+  Py_XDECREF(self->restval);
+  if (self->ranges) {
+    FastCSV_FreeRanges(self->ranges, self->threads);
+    PyMem_Del(self->ranges);
+  }
+  FastCSV_FreeIndex(&self->index);
+  Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
 static PyObject *
@@ -170,341 +695,1249 @@ Reader___exit__(Reader *self, PyObject *args) {
     PyErr_SetString(PyExc_Exception, "have not entered but tried to exit");
     return NULL;
   }
+  ReleaseMapping(self);
   if (PyObject_HasAttrString(self->fileobj, "close")) {
     PyObject_CallMethod(self->fileobj, "close", NULL);
   }
   Py_RETURN_NONE;
 }
 
-typedef enum {
-  SEE_SPLITTER,
-  SEE_LINEENDING,
-  SEE_QUOTE,
-  SEE_EOL,
-  SEE_CR_EOL,
-} BreakReason;
-
-/* Support function: Seek
-   Takes unicode buffer of a line and returns an Unicode object and break
-   reason. It finds splitter(',') or lineending or quote('"'), and returns an
-   Unicode object of the substring from start to just before the found char.
- */
-static BreakReason
-Seek(Reader *self, PyObject **ppret, unsigned char skip_splitter,
-     unsigned char contain_newline)
+/* Support function: Decode
+   Creates a cell from raw characters. In bytes mode, the bytes are decoded
+   with the codec.
+ */
+static PyObject *
+Decode(Reader *self, int kind, const char *data, Py_ssize_t size) {
+  if (self->codec) {
+    return self->codec->decode(self->codec, data, size,
+                               PyUnicode_AsUTF8(self->errors),
+                               &self->scratch);
+  }
+  return PyUnicode_FromKindAndData(kind, data, size);
+}
+
+/* Support function: AddPosition
+   Prefixes the position of the cell to the ValueError of the conversion.
+ */
+static void
+AddPosition(Reader *self, Py_ssize_t column, int kind, const char *data,
+            Py_ssize_t size)
 {
-  /* Pre-condition: (readbuf != NULL && readbuf_start < end && ppret != NULL)
-   */
-  const Py_UNICODE *buf = PyUnicode_AS_UNICODE(self->readbuf);
-  Py_ssize_t curr = self->readbuf_start;
-  Py_ssize_t end = PyUnicode_GET_SIZE(self->readbuf);
-  Py_ssize_t skip = 0;
-  BreakReason reason = SEE_EOL;
-
-  for (; curr < end; curr++) {
-    if (buf[curr] == '"') {
-      reason = SEE_QUOTE;
-      skip = 1;
-      break;
-    } else if (!skip_splitter && buf[curr] == ',') {
-      reason = SEE_SPLITTER;
-      skip = 1;
-      break;
-    } else if (!contain_newline) {
-      if ((self->newline_mode == UniversalNewline ||
-           self->newline_mode == CRLF) &&
-          buf[curr] == '\r' &&
-          ((curr+1 < end && buf[curr+1] == '\n') || curr+1 == end)) {
-        if (curr+1 < end) {
-          reason = SEE_LINEENDING;
-          skip = 2;
-        } else {
-          reason = SEE_CR_EOL;
-          skip = 1;
-        }
-        break;
-      } else if ((self->newline_mode == UniversalNewline ||
-                  self->newline_mode == CR) &&
-                 buf[curr] == '\r') {
-        reason = SEE_LINEENDING;
-        skip = 1;
-        break;
-      } else if ((self->newline_mode == UniversalNewline ||
-                  self->newline_mode == LF) &&
-                 buf[curr] == '\n') {
-        reason = SEE_LINEENDING;
-        skip = 1;
-        break;
-      }
-    }
+  PyObject *type, *value, *traceback, *text;
+  PyErr_Fetch(&type, &value, &traceback);
+  PyErr_NormalizeException(&type, &value, &traceback);
+  text = Decode(self, kind, data, size);
+  if (text) {
+    PyErr_Format(PyExc_ValueError, "row %zd, column %zd: %S: %R",
+                 self->row_num, column + 1, value, text);
+    Py_DECREF(text);
+  } else {
+    PyErr_Clear();
+    PyErr_Format(PyExc_ValueError, "row %zd, column %zd: %S",
+                 self->row_num, column + 1, value);
   }
-  *ppret = PyUnicode_FromUnicode(buf + self->readbuf_start,
-                                 curr - self->readbuf_start);
-  self->readbuf_start = curr + skip;
-  return reason;
-  /* Post-condition: **ppret can be NULL && readbuf_start <= end */
+  Py_XDECREF(type);
+  Py_XDECREF(value);
+  Py_XDECREF(traceback);
 }
 
-/* Support function: JoinAndClear
-   Takes an array of PyUnicode * and join them into one PyUnicode*.
-   Every object in the array is DECREFed.
+/* Support function: CellText
+   Returns the characters of a cell and stores its length into *psize. An
+   escaped cell is unescaped into the cell buffer, so that every cell is
+   created by exactly one allocation however many doubled quotes it
+   contains. Returns NULL with an exception on error.
  */
-static PyObject *
-JoinAndClear(PyObject **contents, Py_ssize_t content_count) {
-  PyObject *ret;
-  Py_ssize_t retsize, bufidx;
-  Py_UNICODE *buf;
-  Py_ssize_t i, j;
+static const char *
+CellText(Reader *self, const FastCSV_CellSpan *span, Py_ssize_t *psize) {
+  const int kind = self->parser.buf_kind;
+  const char *from = self->parser.buf.data + span->start * kind;
+  Py_ssize_t size = span->end - span->start;
 
-  if (content_count == 1) {
-    ret = contents[0];
-    contents[0] = NULL;
-    return ret;
+  if (span->flags & FASTCSV_CELL_ESCAPED) {
+    if (!FastCSV_BufferReserve(&self->cellbuf, size * kind)) return NULL;
+    size = FastCSV_Unescape(kind, from, size, self->cellbuf.data);
+    from = self->cellbuf.data;
   }
+  *psize = size;
+  return from;
+}
 
-  retsize = 0;
-  for (i = 0; i < content_count; i++) {
-    retsize += PyUnicode_GET_SIZE(contents[i]);
+/* Support function: InternCell
+   Returns the str of the cell from the intern table, or creates it and adds
+   it to the table.
+ */
+static PyObject *
+InternCell(Reader *self, FastCSV_InternTable *table, const char *from,
+           Py_ssize_t size)
+{
+  const int kind = self->parser.buf_kind;
+  Py_hash_t hash;
+  PyObject *value = FastCSV_InternLookup(table, kind, from, size, &hash);
+  if (value) return value;
+  value = Decode(self, kind, from, size);
+  if (value && !FastCSV_InternAdd(table, hash, kind, from, size, value)) {
+    Py_CLEAR(value);
   }
+  return value;
+}
 
-  ret = PyUnicode_FromUnicode(NULL, retsize);
-  if (ret == NULL) return PyErr_NoMemory();
-  buf = PyUnicode_AS_UNICODE(ret);
+/* Support function: MakeCell
+   Creates a cell from a span of the read buffer. A cell of a typed column
+   is converted by the schema.
+ */
+static PyObject *
+MakeCell(Reader *self, const FastCSV_CellSpan *span, Py_ssize_t column) {
+  const int kind = self->parser.buf_kind;
+  Py_ssize_t size;
+  const char *from = CellText(self, span, &size);
 
-  bufidx = 0;
-  for (i = 0; i < content_count; i++) {
-    Py_UNICODE *cellbuf = PyUnicode_AS_UNICODE(contents[i]);
-    for (j = 0; j < PyUnicode_GET_SIZE(contents[i]); j++) {
-      buf[bufidx++] = cellbuf[j];
-    }
+  if (!from) return NULL;
+  if (self->header_record) return Decode(self, kind, from, size);
+  if (column < self->schema_count &&
+      self->schema[column].type != FASTCSV_STR) {
+    PyObject *value = FastCSV_Convert(&self->schema[column], kind, from,
+                                      size);
+    if (!value) AddPosition(self, column, kind, from, size);
+    return value;
   }
-  return ret;
+  if (self->intern_all && !ReserveInterns(self, column + 1)) return NULL;
+  if (column < self->intern_count && self->interns[column].limit) {
+    return InternCell(self, &self->interns[column], from, size);
+  }
+  return Decode(self, kind, from, size);
 }
 
 /* Support function: PackRowAndClear
-   This function receives an array of PyUnicode* and pack them into a list.
-   Every element in the array is (virtually) DECREFed.
+   This function receives an array of PyUnicode* and pack them into a list,
+   or a tuple if tuple is true. Every element in the array is (virtually)
+   DECREFed.
  */
 static PyObject *
-PackRowAndClear(PyObject **cells, Py_ssize_t cell_count) {
+PackRowAndClear(PyObject **cells, Py_ssize_t cell_count,
+                unsigned char tuple)
+{
   PyObject *ret;
   Py_ssize_t i;
 
-  ret = PyList_New(cell_count);
+  ret = tuple ? PyTuple_New(cell_count) : PyList_New(cell_count);
   if (ret == NULL) return PyErr_NoMemory();
 
   for (i = 0; i < cell_count; i++) {
-    PyList_SET_ITEM(ret, i, cells[i]);
+    if (tuple) {
+      PyTuple_SET_ITEM(ret, i, cells[i]);
+    } else {
+      PyList_SET_ITEM(ret, i, cells[i]);
+    }
     cells[i] = NULL;
   }
   return ret;
 }
 
-typedef enum {
-  EXPECT_CELL,
-  EOL_CONTINUE,
-  IN_QUOTE,
-  OUT_QUOTE,
-} ReaderState;
-
-#define CHECK_SIZE(mem, cap, count) \
-  do { \
-    if (count == cap) { \
-      PyObject **tmp; \
-      cap *= 2; \
-      tmp = PyMem_Resize(mem, PyObject *, cap); \
-      if (!tmp) { \
-        PyErr_NoMemory(); \
-        Py_XDECREF(ret); \
-        ret = NULL; \
-        goto free_and_exit; \
-      } \
-    } \
-  } while (0)
+/* Support function: PackDictAndClear
+   Same as PackRowAndClear, but packs the cells into a dict keyed by
+   fieldnames. A missing cell is restval, and the cells after fieldnames are
+   packed into a list of restkey.
+ */
+static PyObject *
+PackDictAndClear(Reader *self, PyObject **cells, Py_ssize_t cell_count) {
+  const Py_ssize_t key_count = PyTuple_GET_SIZE(self->fieldnames);
+  PyObject *ret, *rest = NULL;
+  Py_ssize_t i;
+
+  ret = PyDict_Copy(self->row_template);
+  if (!ret) goto error_exit;
+  for (i = 0; i < cell_count && i < key_count; i++) {
+    if (PyDict_SetItem(ret, PyTuple_GET_ITEM(self->fieldnames, i),
+                       cells[i]) < 0) {
+      goto error_exit;
+    }
+  }
+  if (cell_count > key_count) {
+    rest = PyList_New(cell_count - key_count);
+    if (!rest) goto error_exit;
+    for (i = key_count; i < cell_count; i++) {
+      Py_INCREF(cells[i]);
+      PyList_SET_ITEM(rest, i - key_count, cells[i]);
+    }
+    if (PyDict_SetItem(ret, self->restkey, rest) < 0) goto error_exit;
+    Py_DECREF(rest);
+  }
+  for (i = 0; i < cell_count; i++) Py_CLEAR(cells[i]);
+  return ret;
+
+error_exit:
+  Py_XDECREF(ret);
+  Py_XDECREF(rest);
+  return NULL;
+}
+
+/* Support function: RefillRowAndClear
+   Same as PackRowAndClear, but replaces the cells of the list row in place.
+   The caller makes sure that nobody else refers to row. Every element in
+   the array is DECREFed even on error.
+ */
+static unsigned char
+RefillRowAndClear(PyObject *row, PyObject **cells, Py_ssize_t cell_count) {
+  const Py_ssize_t old_count = PyList_GET_SIZE(row);
+  Py_ssize_t i;
+  unsigned char ok = 1;
+
+  if (old_count > cell_count &&
+      PyList_SetSlice(row, cell_count, old_count, NULL) < 0) {
+    ok = 0;
+  }
+  for (i = 0; i < cell_count; i++) {
+    if (ok && i < old_count) {
+      PyObject *old = PyList_GET_ITEM(row, i);
+      PyList_SET_ITEM(row, i, cells[i]);
+      Py_DECREF(old);
+    } else {
+      if (ok && PyList_Append(row, cells[i]) < 0) ok = 0;
+      Py_DECREF(cells[i]);
+    }
+    cells[i] = NULL;
+  }
+  return ok;
+}
 
+/* The number of the cells in the row of a record with count cells. */
+#define OUTPUT_COUNT(self, count) \
+  ((self)->usecols ? (self)->usecol_count : (count))
+
+/* Support function: OutputCell
+   Creates the i-th cell of the row from the spans of a record. With
+   usecols, it is the cell of the i-th selected column, or None if the
+   record does not have the column. The other cells are never created.
+ */
 static PyObject *
-Reader_iternext(Reader *self) {
-  Py_ssize_t cell_count, content_count;
+OutputCell(Reader *self, const FastCSV_CellSpan *spans, Py_ssize_t count,
+           Py_ssize_t i)
+{
+  const Py_ssize_t column = self->usecols ? self->usecols[i] : i;
+  if (column >= count) Py_RETURN_NONE;
+  return MakeCell(self, &spans[column], column);
+}
+
+/* Support function: BuildRow
+   Creates the cells of a record from its spans and packs them into a row.
+ */
+static PyObject *
+BuildRow(Reader *self, const FastCSV_CellSpan *spans, Py_ssize_t span_count) {
+  const Py_ssize_t output_count = OUTPUT_COUNT(self, span_count);
+  Py_ssize_t cell_count = 0;
+  Py_ssize_t i;
   PyObject *ret = NULL;
-  ReaderState state;
-  unsigned char skip_lf_if_exists = 0;
 
+  if (self->lazy) {
+    return FastCSV_NewLazyRow(self->parser.buf_kind, self->parser.buf.data,
+                              spans, span_count, self->usecols, output_count,
+                              self->codec, self->errors);
+  }
+  if (output_count > self->cell_cap) {
+    PyObject **tmp = self->cells;
+    PyMem_Resize(tmp, PyObject *, output_count);
+    if (!tmp) return PyErr_NoMemory();
+    self->cells = tmp;
+    self->cell_cap = output_count;
+  }
+  for (; cell_count < output_count; cell_count++) {
+    PyObject *cell = OutputCell(self, spans, span_count, cell_count);
+    if (!cell) goto free_and_exit;
+    self->cells[cell_count] = cell;
+  }
+  if (self->row_type == ROW_REUSE && self->last_row &&
+      Py_REFCNT(self->last_row) == 1) {
+    if (!RefillRowAndClear(self->last_row, self->cells, cell_count)) {
+      return NULL;
+    }
+    Py_INCREF(self->last_row);
+    return self->last_row;
+  }
+  if (self->row_type == ROW_DICT) {
+    ret = PackDictAndClear(self, self->cells, cell_count);
+  } else {
+    ret = PackRowAndClear(self->cells, cell_count,
+                          self->row_type == ROW_TUPLE);
+  }
+  if (!ret) goto free_and_exit;
   cell_count = 0;
-  content_count = 0;
+  if (self->row_type == ROW_REUSE) {
+    PyObject *tmp = self->last_row;
+    Py_INCREF(ret);
+    self->last_row = ret;
+    Py_XDECREF(tmp);
+  }
 
-  state = EXPECT_CELL;
-  ret = NULL;
-  while (1) {
-    unsigned char skip_splitter, contain_newline;
-    BreakReason break_reason;
-    PyObject *cellstr;
-
-    if (!self->readbuf ||
-        self->readbuf_start >= PyUnicode_GET_SIZE(self->readbuf))
-    {
-      Py_XDECREF(self->readbuf);
-      self->readbuf = PyObject_CallMethodObjArgs(self->fileobj,
-                                                 self->read_string,
-                                                 self->read_arg,
-                                                 NULL);
-      if (self->readbuf == NULL || PyUnicode_GET_SIZE(self->readbuf) == 0) {
-        if (skip_lf_if_exists) {
-          /* If this flag be set, it expects skip \r char if exists. In this
-             case there is no character left, and a row should be returned. */
-          goto return_row;
-        } else if (!PyErr_Occurred() && (cell_count != 0 || state == IN_QUOTE)) {
-          PyErr_SetString(PyExc_IOError, "unexpected end of data");
-          Py_XDECREF(ret);
-          ret = NULL;
+free_and_exit:
+  for (i = 0; i < cell_count; i++) Py_DECREF(self->cells[i]);
+  return ret;
+}
+
+/* Support function: WidenBuffer
+   Converts the characters in the read buffer to the wider kind. It walks
+   from the end so that no character is overwritten before it is read.
+ */
+static unsigned char
+WidenBuffer(Reader *self, int kind) {
+  FastCSV_Parser *parser = &self->parser;
+  Py_ssize_t i = parser->buf_len;
+  if (!FastCSV_BufferReserve(&parser->buf, self->buf_chars * kind)) return 0;
+  if (parser->buf_kind == PyUnicode_1BYTE_KIND) {
+    const Py_UCS1 *from = (const Py_UCS1 *)parser->buf.data;
+    if (kind == PyUnicode_2BYTE_KIND) {
+      Py_UCS2 *to = (Py_UCS2 *)parser->buf.data;
+      while (i-- > 0) to[i] = from[i];
+    } else {
+      Py_UCS4 *to = (Py_UCS4 *)parser->buf.data;
+      while (i-- > 0) to[i] = from[i];
+    }
+  } else {
+    const Py_UCS2 *from = (const Py_UCS2 *)parser->buf.data;
+    Py_UCS4 *to = (Py_UCS4 *)parser->buf.data;
+    while (i-- > 0) to[i] = from[i];
+  }
+  parser->buf_kind = kind;
+  return 1;
+}
+
+/* Support function: AppendString
+   Appends a str returned by read() to the read buffer.
+ */
+static unsigned char
+AppendString(Reader *self, PyObject *str) {
+  FastCSV_Parser *parser = &self->parser;
+  const Py_ssize_t size = PyUnicode_GET_LENGTH(str);
+  const int kind = PyUnicode_KIND(str);
+  const char *from = (const char *)PyUnicode_DATA(str);
+  char *to;
+
+  if (parser->buf_len == 0) parser->buf_kind = PyUnicode_1BYTE_KIND;
+  if (kind > parser->buf_kind && !WidenBuffer(self, kind)) return 0;
+  if (parser->buf_len + size > self->buf_chars) {
+    self->buf_chars = parser->buf_len + size;
+  }
+  if (!FastCSV_BufferReserve(&parser->buf,
+                             self->buf_chars * parser->buf_kind)) return 0;
+
+  to = parser->buf.data + parser->buf_len * parser->buf_kind;
+  if (kind == parser->buf_kind) {
+    memcpy(to, from, size * kind);
+  } else if (kind == PyUnicode_1BYTE_KIND) {
+    if (parser->buf_kind == PyUnicode_2BYTE_KIND) {
+      FASTCSV_CONVERT_CHARS(Py_UCS1, Py_UCS2, from, from + size, to);
+    } else {
+      FASTCSV_CONVERT_CHARS(Py_UCS1, Py_UCS4, from, from + size, to);
+    }
+  } else {
+    FASTCSV_CONVERT_CHARS(Py_UCS2, Py_UCS4, from, from + size * 2, to);
+  }
+  parser->buf_len += size;
+  return 1;
+}
+
+/* Support function: CheckBOM
+   Skips the BOM of the codec at the head of the stream. It waits until the
+   buffer has as many bytes as the BOM, or the end of the data.
+ */
+static unsigned char
+CheckBOM(Reader *self) {
+  FastCSV_Parser *parser = &self->parser;
+  const char *bom;
+  Py_ssize_t bom_len;
+  if (!self->codec || self->bom_checked) return 1;
+  bom = self->codec->bom;
+  bom_len = bom ? (Py_ssize_t)strlen(bom) : 0;
+  if (parser->buf_len < bom_len && !parser->eof) return 1;
+  self->bom_checked = 1;
+  if (bom && parser->buf_len >= bom_len &&
+      memcmp(parser->buf.data, bom, bom_len) == 0) {
+    parser->buf_pos = parser->scan_pos = bom_len;
+  }
+  return 1;
+}
+
+/* Support function: FillBuffer
+   Moves the unconsumed characters to the head of the read buffer and reads
+   more data after them. The buffer grows if it is full. Sets eof if there is
+   no more data. Returns 0 with an exception on error.
+ */
+static unsigned char
+FillBuffer(Reader *self) {
+  FastCSV_Parser *parser = &self->parser;
+  Py_ssize_t room;
+  PyObject *ret;
+
+  if (!self->readfunc) {
+    /* Everything is in the buffer already. */
+    parser->eof = 1;
+    return CheckBOM(self);
+  }
+  self->stream_base += parser->buf_pos;
+  FastCSV_CompactParser(parser);
+  if (parser->buf_len == self->buf_chars) {
+    self->buf_chars *= 2;
+    if (!FastCSV_BufferReserve(&parser->buf,
+                               self->buf_chars * parser->buf_kind)) return 0;
+  }
+  room = self->buf_chars - parser->buf_len;
+
+  if (self->use_readinto) {
+    PyObject *view = PyMemoryView_FromMemory(
+        parser->buf.data + parser->buf_len, room, PyBUF_WRITE);
+    Py_ssize_t n;
+    if (!view) return 0;
+    ret = PyObject_CallFunctionObjArgs(self->readfunc, view, NULL);
+    Py_DECREF(view);
+    if (!ret) return 0;
+    if (ret == Py_None) {
+      /* No data is available on a non-blocking stream. The next call reads
+         again from here. */
+      Py_DECREF(ret);
+      PyErr_SetString(PyExc_BlockingIOError, "readinto() returned None");
+      return 0;
+    }
+    n = PyLong_AsSsize_t(ret);
+    Py_DECREF(ret);
+    if (n < 0 || n > room) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_IOError, "readinto() returned invalid length");
+      }
+      return 0;
+    }
+    parser->buf_len += n;
+    parser->eof = (n == 0);
+  } else {
+    ret = PyObject_CallFunction(self->readfunc, "n", room);
+    if (!ret) return 0;
+    if (self->codec) {
+      Py_ssize_t size;
+      if (!PyBytes_Check(ret)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "read() should return bytes when encoding is given");
+        Py_DECREF(ret);
+        return 0;
+      }
+      size = PyBytes_GET_SIZE(ret);
+      if (!FastCSV_BufferReserve(&parser->buf, parser->buf_len + size)) {
+        Py_DECREF(ret);
+        return 0;
+      }
+      memcpy(parser->buf.data + parser->buf_len, PyBytes_AS_STRING(ret),
+             size);
+      parser->buf_len += size;
+      if (parser->buf_len > self->buf_chars) self->buf_chars = parser->buf_len;
+      parser->eof = (size == 0);
+    } else {
+      if (!PyUnicode_Check(ret) || FASTCSV_READY(ret) < 0) {
+        if (!PyErr_Occurred()) {
+          PyErr_SetString(PyExc_TypeError, "read() should return str");
         }
-        goto free_and_exit;
+        Py_DECREF(ret);
+        return 0;
+      }
+      parser->eof = (PyUnicode_GET_LENGTH(ret) == 0);
+      if (!AppendString(self, ret)) {
+        Py_DECREF(ret);
+        return 0;
       }
-      self->readbuf_start = 0;
     }
+    Py_DECREF(ret);
+  }
+  return CheckBOM(self);
+}
+
+/* Support function: FindColumn
+   Returns the index of name in the header, or -1 with an exception.
+ */
+static Py_ssize_t
+FindColumn(PyObject *header, PyObject *name, const char *param) {
+  Py_ssize_t j;
+  for (j = 0; j < PyList_GET_SIZE(header); j++) {
+    const int eq = PyObject_RichCompareBool(PyList_GET_ITEM(header, j),
+                                            name, Py_EQ);
+    if (eq < 0) return -1;
+    if (eq) return j;
+  }
+  PyErr_Format(PyExc_ValueError, "%s: %R is not in the header", param,
+               name);
+  return -1;
+}
 
-    if (skip_lf_if_exists) {
-      if (PyUnicode_AS_UNICODE(self->readbuf)[self->readbuf_start] == '\n') {
-        self->readbuf_start++;
+/* Support function: DecodeCell
+   Creates a str from a span regardless of the schema.
+ */
+static PyObject *
+DecodeCell(Reader *self, const FastCSV_CellSpan *span) {
+  Py_ssize_t size;
+  const char *text = CellText(self, span, &size);
+  if (!text) return NULL;
+  return Decode(self, self->parser.buf_kind, text, size);
+}
+
+/* Support function: ReadFieldnames
+   Takes the fieldnames of the dict rows from the header record, selected by
+   usecols.
+ */
+static unsigned char
+ReadFieldnames(Reader *self, const FastCSV_CellSpan *spans,
+               Py_ssize_t count)
+{
+  const Py_ssize_t output_count = OUTPUT_COUNT(self, count);
+  PyObject *names;
+  Py_ssize_t i;
+  unsigned char ok;
+
+  names = PyList_New(output_count);
+  if (!names) return 0;
+  for (i = 0; i < output_count; i++) {
+    const Py_ssize_t column = self->usecols ? self->usecols[i] : i;
+    PyObject *name;
+    if (column < count) {
+      name = DecodeCell(self, &spans[column]);
+      if (!name) {
+        Py_DECREF(names);
+        return 0;
       }
-      goto return_row;
-    }
-
-    skip_splitter = (state == IN_QUOTE);
-    contain_newline = (state == IN_QUOTE);
-    break_reason = Seek(self, &cellstr, skip_splitter, contain_newline);
-    switch (state) {
-      case EXPECT_CELL:
-        switch (break_reason) {
-          case SEE_SPLITTER:
-          case SEE_LINEENDING:
-          case SEE_CR_EOL:
-            CHECK_SIZE(self->cells, self->cell_cap, cell_count);
-            self->cells[cell_count++] = cellstr;
-            if (break_reason == SEE_LINEENDING) goto return_row;
-            if (break_reason == SEE_CR_EOL) skip_lf_if_exists = 1;
-            break;
-
-          case SEE_QUOTE:
-            if (PyUnicode_GET_SIZE(cellstr) != 0) {
-              PyErr_SetString(PyExc_ValueError, "string before quote");
-              Py_DECREF(cellstr);
-              goto free_and_exit;
-            }
-            Py_DECREF(cellstr);
-            state = IN_QUOTE;
-            break;
-
-          case SEE_EOL:
-            CHECK_SIZE(self->contents, self->content_cap, content_count);
-            self->contents[content_count++] = cellstr;
-            state = EOL_CONTINUE;
-            break;
-        }
-        break;
+    } else {
+      Py_INCREF(Py_None);
+      name = Py_None;
+    }
+    PyList_SET_ITEM(names, i, name);
+  }
+  ok = SetFieldnames(self, names);
+  Py_DECREF(names);
+  return ok;
+}
 
-      case EOL_CONTINUE:
-        switch (break_reason) {
-          case SEE_SPLITTER:
-          case SEE_LINEENDING:
-          case SEE_CR_EOL:
-            CHECK_SIZE(self->contents, self->content_cap, content_count);
-            self->contents[content_count++] = cellstr;
-            cellstr = JoinAndClear(self->contents, content_count);
-            if (!cellstr) goto free_and_exit;
-            content_count = 0;
-            CHECK_SIZE(self->cells, self->cell_cap, cell_count);
-            self->cells[cell_count++] = cellstr;
-            if (break_reason == SEE_LINEENDING) goto return_row;
-            if (break_reason == SEE_CR_EOL) skip_lf_if_exists = 1;
-            state = EXPECT_CELL;
-            break;
-
-          case SEE_QUOTE:
-            PyErr_SetString(PyExc_ValueError, "string before quote");
-            Py_DECREF(cellstr);
-            goto free_and_exit;
-
-          case SEE_EOL:
-            CHECK_SIZE(self->contents, self->content_cap, content_count);
-            self->contents[content_count++] = cellstr;
-            break;
-        }
-        break;
+/* Support function: ResolveNames
+   Finds the names in usecols and where in the header record.
+ */
+static unsigned char
+ResolveNames(Reader *self, const FastCSV_CellSpan *spans, Py_ssize_t count)
+{
+  PyObject *header;
+  Py_ssize_t i, j;
 
-      case IN_QUOTE:
-        switch (break_reason) {
-          case SEE_SPLITTER:
-          case SEE_LINEENDING:
-          case SEE_CR_EOL:
-            PyErr_SetString(PyExc_Exception, "programming error");
-            Py_DECREF(cellstr);
-            goto free_and_exit;
-
-          case SEE_QUOTE:
-            CHECK_SIZE(self->contents, self->content_cap, content_count);
-            self->contents[content_count++] = cellstr;
-            state = OUT_QUOTE;
-            break;
-
-          case SEE_EOL:
-            CHECK_SIZE(self->contents, self->content_cap, content_count);
-            self->contents[content_count++] = cellstr;
-            break;
-        }
-        break;
+  header = PyList_New(count);
+  if (!header) return 0;
+  for (j = 0; j < count; j++) {
+    PyObject *name = DecodeCell(self, &spans[j]);
+    if (!name) goto error_exit;
+    PyList_SET_ITEM(header, j, name);
+  }
+  for (i = 0; i < self->usecol_count; i++) {
+    if (self->usecols[i] >= 0) continue;
+    self->usecols[i] = FindColumn(
+        header, PySequence_Fast_GET_ITEM(self->usecol_names, i), "usecols");
+    if (self->usecols[i] < 0) goto error_exit;
+  }
+  for (i = 0; i < self->where_count; i++) {
+    FastCSV_Predicate *pred = &self->where[i];
+    if (pred->column >= 0) continue;
+    pred->column = FindColumn(header, pred->name, "where");
+    if (pred->column < 0) goto error_exit;
+  }
+  for (i = 0; self->intern_names &&
+              i < PySequence_Fast_GET_SIZE(self->intern_names); i++) {
+    PyObject *name = PySequence_Fast_GET_ITEM(self->intern_names, i);
+    if (!PyUnicode_Check(name)) continue;
+    j = FindColumn(header, name, "intern");
+    if (j < 0 || !ReserveInterns(self, j + 1)) goto error_exit;
+    self->interns[j].limit = self->intern_limit;
+  }
+  Py_CLEAR(self->intern_names);
+  Py_DECREF(header);
+  Py_CLEAR(self->usecol_names);
+  self->names_pending = 0;
+  SetSpanLimit(self);
+  return 1;
 
-      case OUT_QUOTE:
-        if (PyUnicode_GET_SIZE(cellstr) != 0) {
-          PyErr_SetString(PyExc_ValueError, "string after quote");
-          Py_DECREF(cellstr);
-          goto free_and_exit;
-        }
-        Py_DECREF(cellstr);
-
-        switch (break_reason) {
-          case SEE_SPLITTER:
-          case SEE_LINEENDING:
-          case SEE_CR_EOL:
-            cellstr = JoinAndClear(self->contents, content_count);
-            if (!cellstr) goto free_and_exit;
-            content_count = 0;
-            CHECK_SIZE(self->cells, self->cell_cap, cell_count);
-            self->cells[cell_count++] = cellstr;
-            if (break_reason == SEE_LINEENDING) goto return_row;
-            if (break_reason == SEE_CR_EOL) skip_lf_if_exists = 1;
-            state = EXPECT_CELL;
-            break;
-
-          case SEE_QUOTE:
-            CHECK_SIZE(self->contents, self->content_cap, content_count);
-            self->contents[content_count++] = PyUnicode_FromString("\"");
-            state = IN_QUOTE;
-            break;
-
-          case SEE_EOL:
-            PyErr_SetString(PyExc_Exception, "programming error");
-            Py_DECREF(cellstr);
-            goto free_and_exit;
-        }
+error_exit:
+  Py_DECREF(header);
+  return 0;
+}
+
+/* Support function: MatchRecord
+   Checks the predicates on the cells of a record without creating them.
+   Returns 1 if the record matches every predicate, 0 if not, or -1 with an
+   exception.
+ */
+static int
+MatchRecord(Reader *self, const FastCSV_CellSpan *spans, Py_ssize_t count) {
+  Py_ssize_t i;
+  for (i = 0; i < self->where_count; i++) {
+    const FastCSV_Predicate *pred = &self->where[i];
+    Py_ssize_t size;
+    const char *text;
+    int ret;
+    if (pred->column >= count) return 0;
+    text = CellText(self, &spans[pred->column], &size);
+    if (!text) return -1;
+    ret = FastCSV_MatchPredicate(pred, self->parser.buf_kind, text, size);
+    if (ret <= 0) return ret;
+  }
+  return 1;
+}
+
+/* Support function: ParallelNext
+   Finds the next record among the records parsed by FastCSV_ParseParallel.
+   When the records run out, it parses the next window of the mapped file.
+   A range is used only if it begins where the previous one ended;
+   otherwise the next window begins there. Same as NextRecord.
+ */
+static int
+ParallelNext(Reader *self, const FastCSV_CellSpan **pspans,
+             Py_ssize_t *pcount)
+{
+  while (1) {
+    if (self->range_index < self->range_count) {
+      FastCSV_Range *range = &self->ranges[self->range_index];
+      const Py_ssize_t i = self->record_index;
+      if (i < range->record_count) {
+        const Py_ssize_t first = i ? range->record_ends[i - 1] : 0;
+        self->record_index++;
+        *pspans = range->parser.spans + first;
+        *pcount = range->record_ends[i] - first;
+        return 1;
+      }
+      self->window_start = range->parser.scan_pos;
+      self->range_index++;
+      self->record_index = 0;
+      if (range->failed) {
+        self->range_count = 0;
+        PyErr_SetString(range->parser.error_type, range->parser.error);
+        return -1;
+      }
+      if (self->range_index < self->range_count &&
+          self->ranges[self->range_index].start != self->window_start) {
+        self->range_count = 0;
+      }
+      continue;
+    }
+    if (self->window_start >= self->map.size) return 0;
+    self->range_count = FastCSV_ParseParallel(
+        self->map.data, self->map.size, self->window_start, self->chunk_size,
+        &self->parser, self->ranges, self->threads);
+    self->range_index = 0;
+    self->record_index = 0;
+    if (self->range_count < 0) {
+      self->range_count = 0;
+      return -1;
+    }
+  }
+}
+
+/* Support function: ParseNext
+   Parses the next record, reading more data as needed. Same as NextRecord.
+ */
+static int
+ParseNext(Reader *self, const FastCSV_CellSpan **pspans, Py_ssize_t *pcount)
+{
+  FastCSV_Parser *parser = &self->parser;
+  if (self->ranges && self->map.data) {
+    return ParallelNext(self, pspans, pcount);
+  }
+  while (1) {
+    if (self->codec && !self->bom_checked) {
+      /* Skip the BOM before parsing the first record. */
+      if (self->push == PUSH_FEEDING) return 0;
+      if (!FillBuffer(self)) return -1;
+      continue;
+    }
+    switch (FastCSV_ParseRecord(parser)) {
+      case PARSE_RECORD:
+        *pspans = parser->spans;
+        *pcount = parser->span_count;
+        /* The spans and the characters stay until the next FillBuffer. */
+        parser->span_count = 0;
+        parser->buf_pos = parser->scan_pos;
+        return 1;
+
+      case PARSE_NEED_MORE:
+        /* The rest of the record comes with the next feed. */
+        if (self->push == PUSH_FEEDING) return 0;
+        if (!FillBuffer(self)) return -1;
         break;
+
+      case PARSE_END:
+        /* Let the next call read again, for a file that is still growing. */
+        parser->eof = 0;
+        return 0;
+
+      case PARSE_ERROR:
+        PyErr_SetString(parser->error_type, parser->error);
+        return -1;
     }
   }
+}
 
-return_row:
-  ret = PackRowAndClear(self->cells, cell_count);
-  if (!ret) goto free_and_exit;
-  cell_count = 0;
+/* Support function: NextRecord
+   Returns 1 and stores the spans of the next record, which are valid until
+   the next call. The record is consumed. Returns 0 at the end of the data,
+   or -1 with an exception. The records that do not match the predicates
+   are skipped. If there are names to resolve, the first record is the
+   header and is returned without being checked. The header of the dict
+   rows is not returned but becomes the fieldnames.
+ */
+static int
+NextRecord(Reader *self, const FastCSV_CellSpan **pspans,
+           Py_ssize_t *pcount)
+{
+  for (;;) {
+    const unsigned char need_fieldnames = (self->row_type == ROW_DICT &&
+                                           !self->fieldnames);
+    const unsigned char is_header = self->names_pending || need_fieldnames;
+    int ret = ParseNext(self, pspans, pcount);
+    self->header_record = 0;
+    if (ret <= 0) return ret;
+    self->row_num++;
+    if (self->names_pending && !ResolveNames(self, *pspans, *pcount)) {
+      return -1;
+    }
+    if (need_fieldnames) {
+      if (!ReadFieldnames(self, *pspans, *pcount)) return -1;
+      continue;
+    }
+    if (is_header) {
+      self->header_record = 1;
+      return 1;
+    }
+    ret = MatchRecord(self, *pspans, *pcount);
+    if (ret != 0) return ret;
+  }
+}
 
-free_and_exit:
-  {
-    int i;
-    for (i = 0; i < cell_count; i++) Py_DECREF(self->cells[i]);
-    for (i = 0; i < content_count; i++) Py_DECREF(self->contents[i]);
+/* Support function: ReadHeader
+   Consumes the header if the names or the fieldnames are not read yet.
+   Returns 0 with an exception on error.
+ */
+static unsigned char
+ReadHeader(Reader *self) {
+  const unsigned char need_fieldnames = (self->row_type == ROW_DICT &&
+                                         !self->fieldnames);
+  const FastCSV_CellSpan *spans;
+  Py_ssize_t count;
+  int ret;
+  if (!HeaderPending(self)) return 1;
+  ret = ParseNext(self, &spans, &count);
+  if (ret <= 0) return ret == 0;
+  self->row_num++;
+  if (self->names_pending && !ResolveNames(self, spans, count)) return 0;
+  return !need_fieldnames || ReadFieldnames(self, spans, count);
+}
+
+/* Support function: Reposition
+   Lets the next record begin at offset in the buffer, which should be the
+   beginning of the record row_num. Only for a Reader that has all the data
+   in the buffer.
+ */
+static void
+Reposition(Reader *self, Py_ssize_t offset, Py_ssize_t row_num) {
+  FastCSV_Parser *parser = &self->parser;
+  parser->buf_pos = offset;
+  parser->eof = 1;
+  FastCSV_ResetParser(parser);
+  self->window_start = offset;
+  self->range_count = self->range_index = self->record_index = 0;
+  self->row_num = row_num;
+}
+
+static PyObject *
+Reader_iternext(Reader *self) {
+  const FastCSV_CellSpan *spans;
+  Py_ssize_t count;
+  if (NextRecord(self, &spans, &count) <= 0) return NULL;
+  return BuildRow(self, spans, count);
+}
+
+/* Support function: ReadRows
+   Reads up to max_rows rows (all the rest if negative) into a list.
+ */
+static PyObject *
+ReadRows(Reader *self, Py_ssize_t max_rows) {
+  Py_ssize_t row_count = 0;
+  PyObject *rows;
+
+  rows = PyList_New(0);
+  if (!rows) return NULL;
+  while (max_rows < 0 || row_count < max_rows) {
+    const FastCSV_CellSpan *spans;
+    Py_ssize_t count;
+    PyObject *row;
+    int err;
+    const int ret = NextRecord(self, &spans, &count);
+    if (ret < 0) goto error_exit;
+    if (ret == 0) break;
+    row = BuildRow(self, spans, count);
+    if (!row) goto error_exit;
+    err = PyList_Append(rows, row);
+    Py_DECREF(row);
+    if (err < 0) goto error_exit;
+    row_count++;
+  }
+  return rows;
+
+error_exit:
+  Py_DECREF(rows);
+  return NULL;
+}
+
+/* Support function: StartPush
+   Checks that the Reader can be fed. Returns 0 with ValueError if not.
+ */
+static unsigned char
+StartPush(Reader *self) {
+  if (self->readfunc || self->map.data) {
+    PyErr_SetString(PyExc_ValueError, "feed requires Reader(None)");
+    return 0;
+  }
+  if (self->push == PUSH_CLOSED) {
+    PyErr_SetString(PyExc_ValueError, "the Reader is closed");
+    return 0;
+  }
+  self->push = PUSH_FEEDING;
+  self->parser.eof = 0;
+  return 1;
+}
+
+static PyObject *
+Reader_feed(Reader *self, PyObject *args) {
+  FastCSV_Parser *parser = &self->parser;
+  PyObject *chunk;
+  Py_ssize_t max_rows = -1;
+
+  if (!PyArg_ParseTuple(args, "O|n", &chunk, &max_rows)) return NULL;
+  if (!StartPush(self)) return NULL;
+  self->stream_base += parser->buf_pos;
+  FastCSV_CompactParser(parser);
+  if (self->codec) {
+    Py_buffer view;
+    unsigned char ok;
+    if (PyObject_GetBuffer(chunk, &view, PyBUF_SIMPLE) < 0) return NULL;
+    ok = FastCSV_BufferReserve(&parser->buf, parser->buf_len + view.len);
+    if (ok) {
+      memcpy(parser->buf.data + parser->buf_len, view.buf, view.len);
+      parser->buf_len += view.len;
+      if (parser->buf_len > self->buf_chars) self->buf_chars = parser->buf_len;
+    }
+    PyBuffer_Release(&view);
+    if (!ok) return NULL;
+  } else {
+    if (!PyUnicode_Check(chunk) || FASTCSV_READY(chunk) < 0) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_TypeError,
+                        "feed() requires str, or bytes with encoding");
+      }
+      return NULL;
+    }
+    if (!AppendString(self, chunk)) return NULL;
+  }
+  if (!CheckBOM(self)) return NULL;
+  /* The rest of the complete rows are returned by read_rows or next. */
+  return ReadRows(self, max_rows);
+}
+
+static PyObject *
+Reader_close(Reader *self, PyObject *args) {
+  if (!StartPush(self)) return NULL;
+  self->push = PUSH_CLOSED;
+  self->parser.eof = 1;
+  if (!CheckBOM(self)) return NULL;
+  return ReadRows(self, -1);
+}
+
+static PyObject *
+Reader_read_rows(Reader *self, PyObject *args) {
+  Py_ssize_t max_rows;
+  if (!PyArg_ParseTuple(args, "n", &max_rows)) return NULL;
+  if (max_rows < 0) {
+    PyErr_SetString(PyExc_ValueError, "n should not be negative");
+    return NULL;
+  }
+  return ReadRows(self, max_rows);
+}
+
+static PyObject *
+Reader_read_all(Reader *self, PyObject *args) {
+  return ReadRows(self, -1);
+}
+
+/* Support function: AppendColumns
+   Appends the cells of a record to the columns. A column that appears first
+   is filled with None for the rows before, and a row shorter than the
+   others gets None in the missing columns.
+ */
+static unsigned char
+AppendColumns(Reader *self, PyObject *columns, Py_ssize_t row_count,
+              const FastCSV_CellSpan *spans, Py_ssize_t count)
+{
+  const Py_ssize_t output_count = OUTPUT_COUNT(self, count);
+  Py_ssize_t i;
+  while (PyList_GET_SIZE(columns) < output_count) {
+    PyObject *column = PyList_New(row_count);
+    if (!column) return 0;
+    for (i = 0; i < row_count; i++) {
+      Py_INCREF(Py_None);
+      PyList_SET_ITEM(column, i, Py_None);
+    }
+    if (PyList_Append(columns, column) < 0) {
+      Py_DECREF(column);
+      return 0;
+    }
+    Py_DECREF(column);
+  }
+  for (i = 0; i < PyList_GET_SIZE(columns); i++) {
+    PyObject *cell;
+    int ret;
+    if (i < output_count) {
+      cell = OutputCell(self, spans, count, i);
+      if (!cell) return 0;
+    } else {
+      cell = Py_None;
+      Py_INCREF(cell);
+    }
+    ret = PyList_Append(PyList_GET_ITEM(columns, i), cell);
+    Py_DECREF(cell);
+    if (ret < 0) return 0;
+  }
+  return 1;
+}
+
+static PyObject *
+Reader_read_columns(Reader *self, PyObject *args) {
+  Py_ssize_t max_rows = -1;
+  Py_ssize_t row_count = 0;
+  PyObject *columns;
+
+  if (!PyArg_ParseTuple(args, "|n", &max_rows)) return NULL;
+  columns = PyList_New(0);
+  if (!columns) return NULL;
+  while (max_rows < 0 || row_count < max_rows) {
+    const FastCSV_CellSpan *spans;
+    Py_ssize_t count;
+    const int ret = NextRecord(self, &spans, &count);
+    if (ret < 0) goto error_exit;
+    if (ret == 0) break;
+    if (!AppendColumns(self, columns, row_count, spans, count)) {
+      goto error_exit;
+    }
+    row_count++;
+  }
+  return columns;
+
+error_exit:
+  Py_DECREF(columns);
+  return NULL;
+}
+
+static PyObject *
+Reader_seek_row(Reader *self, PyObject *args) {
+  const FastCSV_Index *index = &self->index;
+  Py_ssize_t row, base = 0, offset;
+  const FastCSV_CellSpan *spans;
+  Py_ssize_t count;
+
+  if (!PyArg_ParseTuple(args, "n", &row)) return NULL;
+  if (row < 0) {
+    PyErr_SetString(PyExc_ValueError, "row should not be negative");
+    return NULL;
+  }
+  if (!ReadHeader(self)) return NULL;
+
+  /* Start from the nearest indexed record before row, or from the head if
+     it is behind the current one. */
+  offset = self->data_start;
+  if (index->every && row >= index->every) {
+    Py_ssize_t i = row / index->every;
+    if (i > index->offset_count) i = index->offset_count;
+    if (i > 0) {
+      base = i * index->every;
+      offset = index->offsets[i - 1];
+    }
+  }
+  if (row < self->row_num || base > self->row_num) {
+    if (!self->map.data) {
+      PyErr_SetString(PyExc_ValueError,
+                      "seeking back requires Reader.from_path");
+      return NULL;
+    }
+    Reposition(self, offset, base);
+  }
+  while (self->row_num < row) {
+    const int ret = ParseNext(self, &spans, &count);
+    if (ret < 0) return NULL;
+    if (ret == 0) break;
+    self->row_num++;
+  }
+  return PyLong_FromSsize_t(self->row_num);
+}
+
+/* Support function: ParallelTell
+   Finds the end of the last record returned by ParallelNext. A range keeps
+   only the spans of its records, so the records returned from the current
+   range are parsed again, skipping the cells.
+ */
+static unsigned char
+ParallelTell(Reader *self, Py_ssize_t *poffset) {
+  const FastCSV_Range *range;
+  FastCSV_Parser parser;
+  Py_ssize_t i;
+
+  if (self->range_index >= self->range_count) {
+    *poffset = self->window_start;
+    return 1;
+  }
+  range = &self->ranges[self->range_index];
+  memset(&parser, 0, sizeof(parser));
+  FastCSV_InitParser(&parser, self->parser.newline_mode);
+  parser.span_limit = 1;
+  parser.buf.data = self->map.data;
+  parser.buf_len = self->map.size;
+  parser.buf_pos = range->start;
+  parser.eof = 1;
+  FastCSV_ResetParser(&parser);
+  for (i = 0; i < self->record_index; i++) {
+    if (FastCSV_ParseRecord(&parser) != PARSE_RECORD) {
+      FastCSV_FreeParser(&parser);
+      PyErr_SetString(PyExc_RuntimeError, "lost the record boundary");
+      return 0;
+    }
+    parser.span_count = 0;
+    parser.buf_pos = parser.scan_pos;
+  }
+  FastCSV_FreeParser(&parser);
+  *poffset = parser.buf_pos;
+  return 1;
+}
+
+static PyObject *
+Reader_tell(Reader *self, PyObject *args) {
+  const FastCSV_Parser *parser = &self->parser;
+  Py_ssize_t offset;
+  unsigned char skip_lf;
+
+  if (self->ranges && self->map.data) {
+    if (!ParallelTell(self, &offset)) return NULL;
+    /* With the whole file at hand, a record ends with CR and waits for LF
+       only at the end of the file. */
+    skip_lf = (offset == self->map.size && offset > self->data_start &&
+               self->map.data[offset - 1] == '\r' &&
+               parser->newline_mode != LF && parser->newline_mode != CR);
+  } else {
+    offset = self->stream_base + parser->buf_pos;
+    skip_lf = parser->skip_lf;
+  }
+  return Py_BuildValue("(nnO)", offset, self->row_num,
+                       skip_lf ? Py_True : Py_False);
+}
+
+static PyObject *
+Reader_write_index(Reader *self, PyObject *args) {
+  PyObject *path;
+  FastCSV_Index index;
+  int ok;
+
+  memset(&index, 0, sizeof(index));
+  if (!PyArg_ParseTuple(args, "On", &path, &index.every)) return NULL;
+  if (index.every <= 0) {
+    PyErr_SetString(PyExc_ValueError, "every should be positive");
+    return NULL;
+  }
+  if (!self->map.data) {
+    PyErr_SetString(PyExc_ValueError,
+                    "write_index requires Reader.from_path");
+    return NULL;
+  }
+  if (!FastCSV_BuildIndex(&self->parser, self->parser.buf.data,
+                          self->parser.buf_len, self->data_start, &index)) {
+    return NULL;
+  }
+  ok = FastCSV_WriteIndex(path, &index);
+  FastCSV_FreeIndex(&index);
+  if (!ok) return NULL;
+  return PyLong_FromSsize_t(index.record_count);
+}
+
+static PyObject *
+Reader_from_path(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  PyObject *path = NULL;
+  PyObject *reader_args = NULL;
+  PyObject *reader_kwds = NULL;
+  PyObject *value;
+  Reader *reader = NULL;
+  Py_ssize_t threads = 1;
+  Py_ssize_t chunk_size = DEFAULT_CHUNK_SIZE;
+  PyObject *index_path = NULL;
+  PyObject *resume = NULL;
+
+  /* The keyword arguments other than threads, chunk_size, index and resume
+     are passed to Reader. */
+  if (!PyArg_ParseTuple(args, "O", &path)) return NULL;
+  reader_kwds = kwds ? PyDict_Copy(kwds) : PyDict_New();
+  if (!reader_kwds) return NULL;
+  if ((value = PyDict_GetItemString(reader_kwds, "threads"))) {
+    threads = PyLong_AsSsize_t(value);
+    if (threads == -1 && PyErr_Occurred()) goto error_exit;
+    if (PyDict_DelItemString(reader_kwds, "threads") < 0) goto error_exit;
+  }
+  if ((value = PyDict_GetItemString(reader_kwds, "chunk_size"))) {
+    chunk_size = PyLong_AsSsize_t(value);
+    if (chunk_size == -1 && PyErr_Occurred()) goto error_exit;
+    if (PyDict_DelItemString(reader_kwds, "chunk_size") < 0) goto error_exit;
+  }
+  if ((index_path = PyDict_GetItemString(reader_kwds, "index"))) {
+    Py_INCREF(index_path);
+    if (PyDict_DelItemString(reader_kwds, "index") < 0) goto error_exit;
+  }
+  if ((resume = PyDict_GetItemString(reader_kwds, "resume"))) {
+    Py_INCREF(resume);
+    if (PyDict_DelItemString(reader_kwds, "resume") < 0) goto error_exit;
+  }
+  if (threads <= 0 || chunk_size <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "threads and chunk_size should be positive");
+    goto error_exit;
+  }
+  value = PyDict_GetItemString(reader_kwds, "encoding");
+  if (value == Py_None) {
+    PyErr_SetString(PyExc_ValueError, "from_path requires encoding");
+    goto error_exit;
+  }
+  if (!value) {
+    PyObject *utf8 = PyUnicode_FromString("utf-8");
+    if (!utf8) goto error_exit;
+    if (PyDict_SetItemString(reader_kwds, "encoding", utf8) < 0) {
+      Py_DECREF(utf8);
+      goto error_exit;
+    }
+    Py_DECREF(utf8);
+  }
+
+  reader_args = Py_BuildValue("(O)", Py_None);
+  if (!reader_args) goto error_exit;
+  reader = (Reader *)PyObject_Call((PyObject *)type, reader_args,
+                                   reader_kwds);
+  if (!reader) goto error_exit;
+
+  if (!FastCSV_MapFile(path, &reader->map)) goto error_exit;
+  if (reader->map.data) {
+    /* The cells are created from the mapping directly. */
+    FastCSV_BufferFree(&reader->parser.buf);
+    reader->parser.buf.data = reader->map.data;
+    reader->parser.buf.cap = reader->map.size;
+    reader->parser.buf_len = reader->buf_chars = reader->map.size;
+  }
+  reader->parser.eof = 1;
+  CheckBOM(reader);
+  reader->window_start = reader->data_start = reader->parser.buf_pos;
+  if (index_path && index_path != Py_None) {
+    FastCSV_Index *index = &reader->index;
+    if (!FastCSV_ReadIndex(index_path, index)) goto error_exit;
+    if (index->newline_mode != reader->parser.newline_mode ||
+        index->file_size != reader->map.size) {
+      PyErr_Format(PyExc_ValueError, "index %R does not match the file",
+                   index_path);
+      goto error_exit;
+    }
+  }
+  if (threads > 1) {
+    reader->ranges = PyMem_New(FastCSV_Range, threads);
+    if (!reader->ranges) {
+      PyErr_NoMemory();
+      goto error_exit;
+    }
+    memset(reader->ranges, 0, sizeof(FastCSV_Range) * threads);
+    reader->threads = threads;
+    reader->chunk_size = chunk_size;
+  }
+  if (resume && resume != Py_None) {
+    Py_ssize_t offset, row;
+    unsigned char skip_lf;
+    if (!ParseCheckpoint(resume, &offset, &row, &skip_lf)) goto error_exit;
+    if (offset > reader->parser.buf_len) {
+      PyErr_SetString(PyExc_ValueError,
+                      "the file is shorter than the checkpoint");
+      goto error_exit;
+    }
+    /* The header is read from the head of the file if the checkpoint is
+       after it. */
+    if (row > 0 && !ReadHeader(reader)) goto error_exit;
+    if (offset < reader->data_start) offset = reader->data_start;
+    /* The data after the checkpoint is all here, so LF after CR is
+       skipped now. */
+    if (skip_lf && offset < reader->parser.buf_len) {
+      if (reader->parser.buf.data[offset] == '\n') offset++;
+      skip_lf = 0;
+    }
+    Reposition(reader, offset, row);
+    reader->parser.skip_lf = skip_lf;
+  }
+
+  Py_DECREF(reader_args);
+  Py_DECREF(reader_kwds);
+  Py_XDECREF(index_path);
+  Py_XDECREF(resume);
+  return (PyObject *)reader;
+
+error_exit:
+  Py_XDECREF(reader_args);
+  Py_XDECREF(reader_kwds);
+  Py_XDECREF(index_path);
+  Py_XDECREF(resume);
+  Py_XDECREF(reader);
+  return NULL;
+}
+
+static PyObject *
+Reader_intern_stats(Reader *self, PyObject *args) {
+  PyObject *ret;
+  Py_ssize_t i;
+
+  ret = PyDict_New();
+  if (!ret) return NULL;
+  for (i = 0; i < self->intern_count; i++) {
+    const FastCSV_InternTable *table = &self->interns[i];
+    PyObject *key, *value;
+    int err;
+    if (!table->limit) continue;
+    key = PyLong_FromSsize_t(i);
+    value = Py_BuildValue("{snsnsn}", "hits", table->hits,
+                          "misses", table->misses, "size", table->count);
+    err = (!key || !value) ? -1 : PyDict_SetItem(ret, key, value);
+    Py_XDECREF(key);
+    Py_XDECREF(value);
+    if (err < 0) {
+      Py_DECREF(ret);
+      return NULL;
+    }
   }
   return ret;
 }
 
+static PyObject *
+Reader_get_fieldnames(Reader *self, void *closure) {
+  if (!self->fieldnames) Py_RETURN_NONE;
+  return PySequence_List(self->fieldnames);
+}
+
+static PyGetSetDef Reader_getset[] = {
+  { "fieldnames", (getter)Reader_get_fieldnames, NULL,
+    "Keys of the dict rows, or None until the header is read." },
+  {NULL}
+};
+
 static PyMethodDef Reader_methods[] = {
+  { "from_path", (PyCFunction)Reader_from_path,
+    METH_VARARGS | METH_KEYWORDS | METH_CLASS },
+  { "read_rows", (PyCFunction)Reader_read_rows, METH_VARARGS },
+  { "read_all", (PyCFunction)Reader_read_all, METH_NOARGS },
+  { "feed", (PyCFunction)Reader_feed, METH_VARARGS },
+  { "close", (PyCFunction)Reader_close, METH_NOARGS },
+  { "read_columns", (PyCFunction)Reader_read_columns, METH_VARARGS },
+  { "intern_stats", (PyCFunction)Reader_intern_stats, METH_NOARGS },
+  { "seek_row", (PyCFunction)Reader_seek_row, METH_VARARGS },
+  { "tell", (PyCFunction)Reader_tell, METH_NOARGS },
+  { "write_index", (PyCFunction)Reader_write_index, METH_VARARGS },
   { "__enter__", (PyCFunction)Reader___enter__, METH_NOARGS },
   { "__exit__", (PyCFunction)Reader___exit__, METH_VARARGS },
   {NULL}
@@ -530,13 +1963,7 @@ PyTypeObject ReaderType = {
   0,                             /* tp_getattro */
   0,                             /* tp_setattro */
   0,                             /* tp_as_buffer */
-  Py_TPFLAGS_DEFAULT
-#if PY_MAJOR_VERSION >= 3
-    // Py_TPFLAGS_HAVE_ITER is deprecated in Python3.
-#else
-    | Py_TPFLAGS_HAVE_ITER
-#endif
-    , /* tp_flags */
+  Py_TPFLAGS_DEFAULT,            /* tp_flags */
   "FastCSV Reader Object",       /* tp_doc */
   0,                             /* tp_traverse */
   0,                             /* tp_clear */
@@ -546,7 +1973,7 @@ PyTypeObject ReaderType = {
   (iternextfunc)Reader_iternext, /* tp_iternext */
   Reader_methods,                /* tp_methods */
   0,                             /* tp_members */
-  0,                             /* tp_getset */
+  Reader_getset,                 /* tp_getset */
   0,                             /* tp_base */
   0,                             /* tp_dict */
   0,                             /* tp_descr_get */
@@ -0,0 +1,246 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+#include <stddef.h>
+
+#define RAW_SIZE(span) \
+  ((span)->end - (span)->start + ((span)->flags & FASTCSV_CELL_QUOTED ? 2 : 0))
+
+PyObject *
+FastCSV_NewLazyRow(int kind, const char *buf, const FastCSV_CellSpan *spans,
+                   Py_ssize_t span_count, const Py_ssize_t *columns,
+                   Py_ssize_t count, const FastCSV_Codec *codec,
+                   PyObject *errors)
+{
+  FastCSV_LazyRow *row;
+  Py_ssize_t size = count ? count - 1 : 0;
+  Py_ssize_t i, pos = 0;
+
+  for (i = 0; i < count; i++) {
+    const Py_ssize_t column = columns ? columns[i] : i;
+    if (column < span_count) size += RAW_SIZE(&spans[column]);
+  }
+  row = PyObject_NewVar(FastCSV_LazyRow, &LazyRowType, count);
+  if (!row) return NULL;
+  row->kind = kind;
+  row->codec = codec;
+  Py_XINCREF(errors);
+  row->errors = errors;
+  row->size = size;
+  /* Allocate one byte at least, since NULL means an error. */
+  row->data = PyMem_Malloc(size ? size * kind : 1);
+  if (!row->data) {
+    Py_DECREF(row);
+    return PyErr_NoMemory();
+  }
+
+  for (i = 0; i < count; i++) {
+    const Py_ssize_t column = columns ? columns[i] : i;
+    FastCSV_CellSpan *to = &row->spans[i];
+    if (i) PyUnicode_WRITE(kind, row->data, pos++, ',');
+    if (column < span_count) {
+      const FastCSV_CellSpan *from = &spans[column];
+      const unsigned char quoted = (from->flags & FASTCSV_CELL_QUOTED) != 0;
+      memcpy(row->data + pos * kind, buf + (from->start - quoted) * kind,
+             RAW_SIZE(from) * kind);
+      to->start = pos + quoted;
+      to->end = to->start + (from->end - from->start);
+      to->flags = from->flags;
+      pos += RAW_SIZE(from);
+    } else {
+      to->start = to->end = pos;
+      to->flags = FASTCSV_CELL_MISSING;
+    }
+  }
+  return (PyObject *)row;
+}
+
+/* Support function: Decode
+   Creates a str from the characters of a lazy row.
+ */
+static PyObject *
+Decode(FastCSV_LazyRow *row, const char *data, Py_ssize_t size) {
+  PyObject *ret;
+  FastCSV_Buffer scratch = {NULL, 0};
+  const char *errors;
+
+  if (!row->codec) return PyUnicode_FromKindAndData(row->kind, data, size);
+  errors = PyUnicode_AsUTF8(row->errors);
+  if (!errors) return NULL;
+  ret = row->codec->decode(row->codec, data, size, errors, &scratch);
+  FastCSV_BufferFree(&scratch);
+  return ret;
+}
+
+PyObject *
+FastCSV_LazyRowText(FastCSV_LazyRow *row) {
+  return Decode(row, row->data, row->size);
+}
+
+static void
+LazyRow_dealloc(FastCSV_LazyRow *self) {
+  Py_XDECREF(self->errors);
+  PyMem_Free(self->data);
+  PyObject_Del(self);
+}
+
+static Py_ssize_t
+LazyRow_length(FastCSV_LazyRow *self) {
+  return Py_SIZE(self);
+}
+
+static PyObject *
+LazyRow_item(FastCSV_LazyRow *self, Py_ssize_t i) {
+  const FastCSV_CellSpan *span;
+  const char *from;
+  char *unescaped;
+  Py_ssize_t size;
+  PyObject *ret;
+
+  if (i < 0 || i >= Py_SIZE(self)) {
+    PyErr_SetString(PyExc_IndexError, "row index out of range");
+    return NULL;
+  }
+  span = &self->spans[i];
+  if (span->flags & FASTCSV_CELL_MISSING) Py_RETURN_NONE;
+  from = self->data + span->start * self->kind;
+  size = span->end - span->start;
+  if (!(span->flags & FASTCSV_CELL_ESCAPED)) return Decode(self, from, size);
+
+  unescaped = PyMem_Malloc(size * self->kind);
+  if (!unescaped) return PyErr_NoMemory();
+  size = FastCSV_Unescape(self->kind, from, size, unescaped);
+  ret = Decode(self, unescaped, size);
+  PyMem_Free(unescaped);
+  return ret;
+}
+
+static PyObject *
+LazyRow_tolist(FastCSV_LazyRow *self, PyObject *args) {
+  PyObject *ret;
+  Py_ssize_t i;
+
+  ret = PyList_New(Py_SIZE(self));
+  if (!ret) return NULL;
+  for (i = 0; i < Py_SIZE(self); i++) {
+    PyObject *cell = LazyRow_item(self, i);
+    if (!cell) {
+      Py_DECREF(ret);
+      return NULL;
+    }
+    PyList_SET_ITEM(ret, i, cell);
+  }
+  return ret;
+}
+
+static PyObject *
+LazyRow_richcompare(FastCSV_LazyRow *self, PyObject *other, int op) {
+  PyObject *list, *ret;
+  if (FastCSV_LazyRow_Check(other)) {
+    other = LazyRow_tolist((FastCSV_LazyRow *)other, NULL);
+  } else if (PyList_Check(other)) {
+    Py_INCREF(other);
+  } else {
+    Py_RETURN_NOTIMPLEMENTED;
+  }
+  if (!other) return NULL;
+  list = LazyRow_tolist(self, NULL);
+  if (!list) {
+    Py_DECREF(other);
+    return NULL;
+  }
+  ret = PyObject_RichCompare(list, other, op);
+  Py_DECREF(list);
+  Py_DECREF(other);
+  return ret;
+}
+
+static PyObject *
+LazyRow_repr(FastCSV_LazyRow *self) {
+  PyObject *list, *ret;
+  list = LazyRow_tolist(self, NULL);
+  if (!list) return NULL;
+  ret = PyUnicode_FromFormat("LazyRow(%R)", list);
+  Py_DECREF(list);
+  return ret;
+}
+
+static PyObject *
+LazyRow_get_raw(FastCSV_LazyRow *self, void *closure) {
+  return FastCSV_LazyRowText(self);
+}
+
+static PySequenceMethods LazyRow_as_sequence = {
+  (lenfunc)LazyRow_length,     /* sq_length */
+  0,                           /* sq_concat */
+  0,                           /* sq_repeat */
+  (ssizeargfunc)LazyRow_item,  /* sq_item */
+};
+
+static PyGetSetDef LazyRow_getset[] = {
+  { "raw", (getter)LazyRow_get_raw, NULL,
+    "The cells as they were in the record, joined by commas." },
+  {NULL}
+};
+
+static PyMethodDef LazyRow_methods[] = {
+  { "tolist", (PyCFunction)LazyRow_tolist, METH_NOARGS },
+  {NULL}
+};
+
+PyTypeObject LazyRowType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "_fastcsv.LazyRow",                  /* tp_name */
+  offsetof(FastCSV_LazyRow, spans),    /* tp_basicsize */
+  sizeof(FastCSV_CellSpan),            /* tp_itemsize */
+  (destructor)LazyRow_dealloc,         /* tp_dealloc */
+  0,                                   /* tp_print */
+  0,                                   /* tp_getattr */
+  0,                                   /* tp_setattr */
+  0,                                   /* tp_compare */
+  (reprfunc)LazyRow_repr,              /* tp_repr */
+  0,                                   /* tp_as_number */
+  &LazyRow_as_sequence,                /* tp_as_sequence */
+  0,                                   /* tp_as_mapping */
+  PyObject_HashNotImplemented,         /* tp_hash */
+  0,                                   /* tp_call */
+  0,                                   /* tp_str */
+  0,                                   /* tp_getattro */
+  0,                                   /* tp_setattro */
+  0,                                   /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+  "Row whose cells are created on access", /* tp_doc */
+  0,                                   /* tp_traverse */
+  0,                                   /* tp_clear */
+  (richcmpfunc)LazyRow_richcompare,    /* tp_richcompare */
+  0,                                   /* tp_weaklistoffset */
+  0,                                   /* tp_iter */
+  0,                                   /* tp_iternext */
+  LazyRow_methods,                     /* tp_methods */
+  0,                                   /* tp_members */
+  LazyRow_getset,                      /* tp_getset */
+};
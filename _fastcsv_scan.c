@@ -0,0 +1,268 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+#include "_fastcsv.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || \
+    (defined(__i386__) && defined(__SSE2__)) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FASTCSV_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+#define FASTCSV_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/* Support function: FastCSV_CountTrailingZeros
+   Returns the index of the lowest set bit. mask should not be zero.
+ */
+static int
+FastCSV_CountTrailingZeros(unsigned long long mask) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(mask);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanForward64(&index, mask);
+  return (int)index;
+#else
+  int n = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+/* Scalar kernels. These are the reference implementation and the fallback on
+   the platforms without SIMD. */
+#define SCALAR_FIND(CHAR_T, NAME) \
+  static Py_ssize_t \
+  NAME(const void *data, Py_ssize_t curr, Py_ssize_t end, \
+       const FastCSV_CharSet *set) \
+  { \
+    const CHAR_T *buf = (const CHAR_T *)data; \
+    for (; curr < end; curr++) { \
+      const CHAR_T c = buf[curr]; \
+      if (c == set->c[0] || c == set->c[1] || \
+          c == set->c[2] || c == set->c[3]) { \
+        break; \
+      } \
+    } \
+    return curr; \
+  }
+
+SCALAR_FIND(Py_UCS1, FindAny_ucs1_scalar)
+SCALAR_FIND(Py_UCS2, FindAny_ucs2_scalar)
+SCALAR_FIND(Py_UCS4, FindAny_ucs4_scalar)
+
+#undef SCALAR_FIND
+
+#ifdef FASTCSV_HAVE_SSE2
+#define FIND_TARGET
+#define VEC_T __m128i
+#define VEC_BYTES 16
+#define VEC_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define VEC_OR _mm_or_si128
+#define VEC_MOVEMASK _mm_movemask_epi8
+
+#define CHAR_T Py_UCS1
+#define FIND_NAME FindAny_ucs1_sse2
+#define VEC_SET1(c) _mm_set1_epi8((char)(c))
+#define VEC_CMPEQ _mm_cmpeq_epi8
+#include "_fastcsv_scan.h"
+#define CHAR_T Py_UCS2
+#define FIND_NAME FindAny_ucs2_sse2
+#define VEC_SET1(c) _mm_set1_epi16((short)(c))
+#define VEC_CMPEQ _mm_cmpeq_epi16
+#include "_fastcsv_scan.h"
+#define CHAR_T Py_UCS4
+#define FIND_NAME FindAny_ucs4_sse2
+#define VEC_SET1(c) _mm_set1_epi32((int)(c))
+#define VEC_CMPEQ _mm_cmpeq_epi32
+#include "_fastcsv_scan.h"
+
+#undef FIND_TARGET
+#undef VEC_T
+#undef VEC_BYTES
+#undef VEC_LOAD
+#undef VEC_OR
+#undef VEC_MOVEMASK
+#endif
+
+#ifdef FASTCSV_HAVE_AVX2
+#ifdef _MSC_VER
+#define FIND_TARGET
+#else
+#define FIND_TARGET __attribute__((target("avx2")))
+#endif
+#define VEC_T __m256i
+#define VEC_BYTES 32
+#define VEC_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define VEC_OR _mm256_or_si256
+#define VEC_MOVEMASK _mm256_movemask_epi8
+
+#define CHAR_T Py_UCS1
+#define FIND_NAME FindAny_ucs1_avx2
+#define VEC_SET1(c) _mm256_set1_epi8((char)(c))
+#define VEC_CMPEQ _mm256_cmpeq_epi8
+#include "_fastcsv_scan.h"
+#define CHAR_T Py_UCS2
+#define FIND_NAME FindAny_ucs2_avx2
+#define VEC_SET1(c) _mm256_set1_epi16((short)(c))
+#define VEC_CMPEQ _mm256_cmpeq_epi16
+#include "_fastcsv_scan.h"
+#define CHAR_T Py_UCS4
+#define FIND_NAME FindAny_ucs4_avx2
+#define VEC_SET1(c) _mm256_set1_epi32((int)(c))
+#define VEC_CMPEQ _mm256_cmpeq_epi32
+#include "_fastcsv_scan.h"
+
+#undef FIND_TARGET
+#undef VEC_T
+#undef VEC_BYTES
+#undef VEC_LOAD
+#undef VEC_OR
+#undef VEC_MOVEMASK
+
+/* Support function: CPUSupportsAVX2
+   Checks both the CPU and the OS (the upper halves of YMM registers should be
+   saved on context switches).
+ */
+static int
+CPUSupportsAVX2(void) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return 0;
+  __cpuid(info, 1);
+  /* OSXSAVE and AVX */
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return 0;
+  if ((_xgetbv(0) & 6) != 6) return 0;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static const FastCSV_Scanner scanners[] = {
+#ifdef FASTCSV_HAVE_AVX2
+  { "avx2", { FindAny_ucs1_avx2, FindAny_ucs2_avx2, FindAny_ucs4_avx2 } },
+#endif
+#ifdef FASTCSV_HAVE_SSE2
+  { "sse2", { FindAny_ucs1_sse2, FindAny_ucs2_sse2, FindAny_ucs4_sse2 } },
+#endif
+  { "scalar",
+    { FindAny_ucs1_scalar, FindAny_ucs2_scalar, FindAny_ucs4_scalar } },
+};
+
+#define SCANNER_COUNT ((int)(sizeof(scanners) / sizeof(scanners[0])))
+
+const FastCSV_Scanner *fastcsv_scanner = &scanners[SCANNER_COUNT - 1];
+
+static int
+ScannerAvailable(const FastCSV_Scanner *scanner) {
+#ifdef FASTCSV_HAVE_AVX2
+  if (strcmp(scanner->name, "avx2") == 0) return CPUSupportsAVX2();
+#endif
+  return 1;
+}
+
+void
+FastCSV_InitScanner(void) {
+  int i;
+  for (i = 0; i < SCANNER_COUNT; i++) {
+    if (ScannerAvailable(&scanners[i])) {
+      fastcsv_scanner = &scanners[i];
+      return;
+    }
+  }
+}
+
+void
+FastCSV_InitCharSet(FastCSV_CharSet *set, const char *chars) {
+  const size_t len = strlen(chars);
+  size_t i;
+  for (i = 0; i < 4; i++) {
+    set->c[i] = (unsigned char)(i < len ? chars[i] : chars[0]);
+  }
+}
+
+/* Module function: _scanners
+   Returns the names of the scanners that can run on this CPU. The first one
+   is the one selected by default. Used by the tests to check the SIMD
+   scanners against the scalar one.
+ */
+PyObject *
+FastCSV_scanners(PyObject *module, PyObject *args) {
+  PyObject *ret = PyList_New(0);
+  int i;
+  if (!ret) return NULL;
+  for (i = 0; i < SCANNER_COUNT; i++) {
+    if (ScannerAvailable(&scanners[i])) {
+      PyObject *name = PyUnicode_FromString(scanners[i].name);
+      if (!name || PyList_Append(ret, name) < 0) {
+        Py_XDECREF(name);
+        Py_DECREF(ret);
+        return NULL;
+      }
+      Py_DECREF(name);
+    }
+  }
+  return ret;
+}
+
+/* Module function: _set_scanner
+   Switches the scanner used by every Reader and returns the name of the
+   previous one.
+ */
+PyObject *
+FastCSV_set_scanner(PyObject *module, PyObject *arg) {
+  const char *name;
+  int i;
+  if (!PyUnicode_Check(arg)) {
+    PyErr_SetString(PyExc_TypeError, "scanner name should be str");
+    return NULL;
+  }
+  name = PyUnicode_AsUTF8(arg);
+  if (!name) return NULL;
+  for (i = 0; i < SCANNER_COUNT; i++) {
+    if (strcmp(scanners[i].name, name) == 0 &&
+        ScannerAvailable(&scanners[i])) {
+      const FastCSV_Scanner *prev = fastcsv_scanner;
+      fastcsv_scanner = &scanners[i];
+      return PyUnicode_FromString(prev->name);
+    }
+  }
+  PyErr_Format(PyExc_ValueError, "scanner %s is not available", name);
+  return NULL;
+}
@@ -0,0 +1,95 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+
+/* Template of the vectorized FindAny kernels. _fastcsv_scan.c includes this
+   file once per PEP 393 kind and instruction set with these macros defined:
+
+     CHAR_T        Py_UCS1, Py_UCS2 or Py_UCS4
+     FIND_NAME     name of the generated function
+     FIND_TARGET   function attribute that enables the instruction set
+     VEC_T         vector type
+     VEC_BYTES     size of VEC_T in bytes
+     VEC_LOAD      unaligned load
+     VEC_SET1      broadcast of an ASCII character to every lane
+     VEC_CMPEQ     lane-wise comparison
+     VEC_OR        bitwise or
+     VEC_MOVEMASK  one bit per byte of the comparison result
+
+   The kernel builds a bitmask of the structural characters in every 64 byte
+   block and finds the first one with a count of trailing zeros. Since every
+   character occupies sizeof(CHAR_T) bytes, the bit index is divided by the
+   character size. The remainder shorter than a vector goes through the
+   scalar loop.
+ */
+FIND_TARGET static Py_ssize_t
+FIND_NAME(const void *data, Py_ssize_t curr, Py_ssize_t end,
+          const FastCSV_CharSet *set)
+{
+  const CHAR_T *buf = (const CHAR_T *)data;
+  const Py_ssize_t block = 64 / sizeof(CHAR_T);
+  const Py_ssize_t lanes = VEC_BYTES / sizeof(CHAR_T);
+  const VEC_T c0 = VEC_SET1(set->c[0]);
+  const VEC_T c1 = VEC_SET1(set->c[1]);
+  const VEC_T c2 = VEC_SET1(set->c[2]);
+  const VEC_T c3 = VEC_SET1(set->c[3]);
+
+  for (; curr + block <= end; curr += block) {
+    unsigned long long mask = 0;
+    int i;
+    for (i = 0; i < 64 / VEC_BYTES; i++) {
+      const VEC_T v = VEC_LOAD(buf + curr + i * lanes);
+      const VEC_T eq = VEC_OR(VEC_OR(VEC_CMPEQ(v, c0), VEC_CMPEQ(v, c1)),
+                              VEC_OR(VEC_CMPEQ(v, c2), VEC_CMPEQ(v, c3)));
+      mask |= (unsigned long long)(unsigned int)VEC_MOVEMASK(eq) <<
+        (i * VEC_BYTES);
+    }
+    if (mask) {
+      return curr + FastCSV_CountTrailingZeros(mask) / sizeof(CHAR_T);
+    }
+  }
+  for (; curr + lanes <= end; curr += lanes) {
+    const VEC_T v = VEC_LOAD(buf + curr);
+    const VEC_T eq = VEC_OR(VEC_OR(VEC_CMPEQ(v, c0), VEC_CMPEQ(v, c1)),
+                            VEC_OR(VEC_CMPEQ(v, c2), VEC_CMPEQ(v, c3)));
+    const unsigned int mask = (unsigned int)VEC_MOVEMASK(eq);
+    if (mask) {
+      return curr + FastCSV_CountTrailingZeros(mask) / sizeof(CHAR_T);
+    }
+  }
+  for (; curr < end; curr++) {
+    const CHAR_T c = buf[curr];
+    if (c == set->c[0] || c == set->c[1] ||
+        c == set->c[2] || c == set->c[3]) {
+      break;
+    }
+  }
+  return curr;
+}
+
+#undef CHAR_T
+#undef FIND_NAME
+#undef VEC_SET1
+#undef VEC_CMPEQ
@@ -0,0 +1,87 @@
+/* License: BSD 2-Clause License {{{
+
+ Copyright (c) 2013, Masaya SUZUKI <draftcode@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE FREEBSD PROJECT ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ NO EVENT SHALL THE FREEBSD PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ }}} */
+
+/* Template of the Seek kernel. _fastcsv_parser.c includes this file once per
+   PEP 393 kind with these macros defined:
+
+     CHAR_T     Py_UCS1, Py_UCS2 or Py_UCS4
+     SEEK_NAME  name of the generated function
+
+   The kernel scans buf[*pcurr..end) and stops at the first splitter, quote or
+   lineending. It stores the stop position into *pcurr and the number of
+   characters to skip into *pskip. Candidates are found by the FindAny kernel
+   of the current scanner; set contains only the characters that can stop
+   the scan in the current state, so the loop below just classifies them.
+ */
+static BreakReason
+SEEK_NAME(const void *data, Py_ssize_t *pcurr, Py_ssize_t end,
+          FastCSV_NewlineMode newline_mode, FastCSV_FindFunc find,
+          const FastCSV_CharSet *set, Py_ssize_t *pskip)
+{
+  const CHAR_T *buf = (const CHAR_T *)data;
+  Py_ssize_t curr = *pcurr;
+  BreakReason reason = SEE_EOL;
+  Py_ssize_t skip = 0;
+
+  for (; (curr = find(data, curr, end, set)) < end; curr++) {
+    const CHAR_T c = buf[curr];
+    if (c == '"') {
+      reason = SEE_QUOTE;
+      skip = 1;
+      break;
+    } else if (c == ',') {
+      reason = SEE_SPLITTER;
+      skip = 1;
+      break;
+    } else if (c == '\n') {
+      reason = SEE_LINEENDING;
+      skip = 1;
+      break;
+    } else if (newline_mode != CR &&
+               (curr+1 == end || buf[curr+1] == '\n')) {
+      /* \r\n, or \r at the end of the buffer */
+      if (curr+1 < end) {
+        reason = SEE_LINEENDING;
+        skip = 2;
+      } else {
+        reason = SEE_CR_EOL;
+        skip = 1;
+      }
+      break;
+    } else if (newline_mode != CRLF) {
+      reason = SEE_LINEENDING;
+      skip = 1;
+      break;
+    }
+    /* A lone \r in CRLF mode is a part of the cell. */
+  }
+  *pcurr = curr;
+  *pskip = skip;
+  return reason;
+}
+
+#undef CHAR_T
+#undef SEEK_NAME
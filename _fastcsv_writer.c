@@ -23,7 +23,31 @@
  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  }}} */
-#include <Python.h>
+#include "_fastcsv.h"
+
+#include <datetime.h>
+#include "pythread.h"
+#ifdef MS_WINDOWS
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define DEFAULT_BUFFER_SIZE (64 * 1024)
+#define DEFAULT_QUEUE_DEPTH 2
+/* Enough for a long long and a datetime without tzinfo. */
+#define FORMAT_BUFFER_SIZE 32
+
+/* The values are the same as the constants of the csv module. */
+typedef enum {
+  /* Only the cells that have a special character are quoted. */
+  QUOTE_MINIMAL,
+  QUOTE_ALL,
+  /* Every cell is quoted except numbers. */
+  QUOTE_NONNUMERIC,
+  /* No cell is quoted. A cell that needs quotes is an error. */
+  QUOTE_NONE,
+} QuotingMode;
 
 typedef struct {
   PyObject_HEAD
@@ -31,66 +55,119 @@ typedef struct {
   PyObject *writefunc;
   PyObject *newline;
   unsigned char entered;
-  unsigned char strict;
+  QuotingMode quoting;
+  /* The digits after the decimal point of a float, or -1 for repr(). */
+  int float_precision;
+  /* The characters that make a cell quoted, and the quote. */
+  FastCSV_CharSet special_set, quote_set;
 
-  Py_UNICODE *writebuf;
+  /* writebuf holds writebuf_cap characters of writebuf_kind. It is allocated
+     for the widest kind so that it can be widened in place. A string that
+     does not fit in it is written through. */
+  void *writebuf;
+  int writebuf_kind;
   Py_ssize_t writebuf_start, writebuf_cap;
-} Writer;
 
-static PyObject *comma_string = NULL;
-static PyObject *quote_string = NULL;
-static PyObject *twoquote_string = NULL;
-
-static int
-InitializeConstants(void) {
-  unsigned char comma_string_referred = 0;
-  unsigned char quote_string_referred = 0;
-  unsigned char twoquote_string_referred = 0;
+  /* In bytes mode, codec is not NULL and fileobj should be a binary file.
+     The characters are encoded into writebuf, which holds writebuf_start
+     bytes then. */
+  const FastCSV_Codec *codec;
+  PyObject *errors;
 
-  if (!comma_string) {
-    comma_string = PyUnicode_FromString(",");
-    if (!comma_string) goto error_exit;
-  }
-  Py_INCREF(comma_string);
-  comma_string_referred = 1;
+  /* If fileobj is a file descriptor, writebuf is the current buffer of
+     flusher, and the filled ones are written on its thread. Both are NULL
+     after close. */
+  FastCSV_Flusher *flusher;
+  /* Held by lock_owner while it writes a row or hands the buffers to
+     flusher, which releases the GIL. Only with flusher. */
+  PyThread_type_lock lock;
+  unsigned long lock_owner;
+} Writer;
 
-  if (!quote_string) {
-    quote_string = PyUnicode_FromString("\"");
-    if (!quote_string) goto error_exit;
+static unsigned char
+ParseQuoting(PyObject *quoting, QuotingMode *pquoting) {
+  static const char *names[] = {"minimal", "all", "nonnumeric", "none"};
+  Py_ssize_t i;
+  if (PyLong_Check(quoting)) {
+    /* The constants of the csv module. */
+    const long value = PyLong_AsLong(quoting);
+    if (value >= QUOTE_MINIMAL && value <= QUOTE_NONE) {
+      *pquoting = (QuotingMode)value;
+      return 1;
+    }
+  } else if (PyUnicode_Check(quoting)) {
+    for (i = 0; i < 4; i++) {
+      if (PyUnicode_CompareWithASCIIString(quoting, names[i]) == 0) {
+        *pquoting = (QuotingMode)i;
+        return 1;
+      }
+    }
   }
-  Py_INCREF(quote_string);
-  quote_string_referred = 1;
-
-  if (!twoquote_string) {
-    twoquote_string = PyUnicode_FromString("\"\"");
-    if (!twoquote_string) goto error_exit;
+  if (!PyErr_Occurred()) {
+    PyErr_SetString(PyExc_ValueError,
+                    "quoting should be 'minimal', 'all', 'nonnumeric' or "
+                    "'none'");
   }
-  Py_INCREF(twoquote_string);
-  twoquote_string_referred = 1;
-
-  return 1;
-
-error_exit:
-  if (comma_string_referred) Py_DECREF(comma_string);
-  if (quote_string_referred) Py_DECREF(quote_string);
-  if (twoquote_string_referred) Py_DECREF(twoquote_string);
   return 0;
 }
 
 static int
 Writer_init(Writer *self, PyObject *args, PyObject *kwds) {
-  static char *kwlist[] = {"fileobj", "newline", "strict", NULL};
+  static char *kwlist[] = {"fileobj", "newline", "strict", "buffer_size",
+                           "quoting", "encoding", "errors", "bom",
+                           "float_precision", "queue_depth", "fsync",
+                           "closefd", NULL};
   PyObject *fileobj = NULL;
   PyObject *newline = NULL;
   PyObject *strict = NULL;
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO", kwlist,
+  Py_ssize_t buffer_size = DEFAULT_BUFFER_SIZE;
+  PyObject *quoting = NULL;
+  PyObject *encoding = NULL;
+  PyObject *errors = NULL;
+  PyObject *bom = NULL;
+  PyObject *float_precision = NULL;
+  Py_ssize_t queue_depth = DEFAULT_QUEUE_DEPTH;
+  PyObject *sync = NULL;
+  PyObject *closefd = NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOnOOOOOnOO", kwlist,
                                    &fileobj,
                                    &newline,
-                                   &strict))
+                                   &strict,
+                                   &buffer_size,
+                                   &quoting,
+                                   &encoding,
+                                   &errors,
+                                   &bom,
+                                   &float_precision,
+                                   &queue_depth,
+                                   &sync,
+                                   &closefd))
     goto error_exit;
-
-  if (!InitializeConstants())
+  if (self->flusher) {
+    FastCSV_StopFlusher(self->flusher);
+    self->flusher = NULL;
+    self->writebuf = NULL;
+  }
+  if (buffer_size <= 0 || queue_depth <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "buffer_size and queue_depth should be positive");
     goto error_exit;
+  }
+  self->float_precision = -1;
+  if (float_precision && float_precision != Py_None) {
+    const long value = PyLong_AsLong(float_precision);
+    if (value == -1 && PyErr_Occurred()) goto error_exit;
+    if (value < 0 || value > 100) {
+      PyErr_SetString(PyExc_ValueError,
+                      "float_precision should be between 0 and 100");
+      goto error_exit;
+    }
+    self->float_precision = (int)value;
+  }
+  if (!PyDateTimeAPI) {
+    PyDateTime_IMPORT;
+    if (!PyDateTimeAPI) goto error_exit;
+  }
 
   if (!newline || newline == Py_None) {
     self->newline = PyUnicode_FromString("\r\n");
@@ -100,11 +177,74 @@ Writer_init(Writer *self, PyObject *args, PyObject *kwds) {
     self->newline = newline;
   }
 
-  self->writebuf_cap = 1024;
-  self->writebuf = PyMem_New(Py_UNICODE, self->writebuf_cap);
-  if (!self->writebuf) goto error_exit;
+  if (self->writebuf) PyMem_Free(self->writebuf);
+  self->writebuf_cap = buffer_size;
+  self->writebuf =
+    (buffer_size <= PY_SSIZE_T_MAX / (Py_ssize_t)sizeof(Py_UCS4))
+    ? PyMem_Malloc(buffer_size * sizeof(Py_UCS4)) : NULL;
+  if (!self->writebuf) {
+    PyErr_NoMemory();
+    goto error_exit;
+  }
+  self->writebuf_kind = PyUnicode_1BYTE_KIND;
+  self->writebuf_start = 0;
 
-  self->strict = (strict != NULL && PyObject_IsTrue(strict));
+  self->codec = NULL;
+  if (encoding && encoding != Py_None) {
+    self->codec = FastCSV_LookupEncoder(encoding);
+    if (!self->codec) goto error_exit;
+  } else if (PyLong_Check(fileobj)) {
+    /* A file descriptor takes bytes. */
+    PyObject *utf8 = PyUnicode_FromString("utf-8");
+    if (!utf8) goto error_exit;
+    self->codec = FastCSV_LookupEncoder(utf8);
+    Py_DECREF(utf8);
+    if (!self->codec) goto error_exit;
+  }
+  if (errors && errors != Py_None) {
+    if (!PyUnicode_Check(errors)) {
+      PyErr_SetString(PyExc_TypeError, "errors should be str");
+      goto error_exit;
+    }
+    Py_INCREF(errors);
+  } else {
+    errors = PyUnicode_FromString("strict");
+    if (!errors) goto error_exit;
+  }
+  {
+    PyObject *tmp = self->errors;
+    self->errors = errors;
+    Py_XDECREF(tmp);
+  }
+  if (bom && bom != Py_None) {
+    const int write_bom = PyObject_IsTrue(bom);
+    if (write_bom < 0) goto error_exit;
+    if (write_bom && (!self->codec ||
+                      strcmp(self->codec->fallback, "utf-8") != 0)) {
+      PyErr_SetString(PyExc_ValueError, "bom requires a UTF-8 encoding");
+      goto error_exit;
+    }
+    bom = write_bom ? Py_True : Py_False;
+  } else {
+    /* utf-8-sig writes the BOM by default, like the Python codec. */
+    bom = (self->codec && self->codec->bom) ? Py_True : Py_False;
+  }
+  if (bom == Py_True) {
+    memcpy(self->writebuf, "\xef\xbb\xbf", 3);
+    self->writebuf_start = 3;
+  }
+
+  /* strict is the old name of the minimal quoting. */
+  self->quoting = QUOTE_ALL;
+  if (quoting && quoting != Py_None) {
+    if (!ParseQuoting(quoting, &self->quoting)) goto error_exit;
+  } else if (strict) {
+    const int is_strict = PyObject_IsTrue(strict);
+    if (is_strict < 0) goto error_exit;
+    if (is_strict) self->quoting = QUOTE_MINIMAL;
+  }
+  FastCSV_InitCharSet(&self->special_set, ",\"\r\n");
+  FastCSV_InitCharSet(&self->quote_set, "\"");
   self->entered = 0;
 
   {
@@ -114,46 +254,184 @@ Writer_init(Writer *self, PyObject *args, PyObject *kwds) {
     Py_XDECREF(tmp);
   }
 
-  self->writefunc = PyObject_GetAttrString(self->fileobj, "write");
-  if (!self->writefunc) goto error_exit;
+  if (PyLong_Check(fileobj)) {
+    const long fd = PyLong_AsLong(fileobj);
+    int do_close = 1, do_sync = 0;
+    if (fd == -1 && PyErr_Occurred()) goto error_exit;
+    if (fd < 0 || fd > INT_MAX) {
+      PyErr_SetString(PyExc_ValueError, "invalid file descriptor");
+      goto error_exit;
+    }
+    if (closefd && (do_close = PyObject_IsTrue(closefd)) < 0) goto error_exit;
+    if (sync && (do_sync = PyObject_IsTrue(sync)) < 0) goto error_exit;
+    /* Started last, since it closes fd when it stops. */
+    self->flusher = FastCSV_StartFlusher((int)fd,
+                                         self->writebuf_cap * sizeof(Py_UCS4),
+                                         queue_depth, (unsigned char)do_close,
+                                         (unsigned char)do_sync);
+    if (!self->flusher) goto error_exit;
+    if (!self->lock && !(self->lock = PyThread_allocate_lock())) {
+      FastCSV_StopFlusher(self->flusher);
+      self->flusher = NULL;
+      PyErr_NoMemory();
+      goto error_exit;
+    }
+    /* Move the BOM. */
+    memcpy(FastCSV_FlusherBuffer(self->flusher), self->writebuf,
+           self->writebuf_start);
+    PyMem_Free(self->writebuf);
+    self->writebuf = FastCSV_FlusherBuffer(self->flusher);
+  } else {
+    self->writefunc = PyObject_GetAttrString(self->fileobj, "write");
+    if (!self->writefunc) goto error_exit;
+  }
 
   return 0;
 
 error_exit:
-  Py_XDECREF(self->fileobj);
-  Py_XDECREF(self->writefunc);
-  Py_XDECREF(self->newline);
-  if (self->writebuf) PyMem_Del(self->writebuf);
+  Py_CLEAR(self->fileobj);
+  Py_CLEAR(self->writefunc);
+  Py_CLEAR(self->newline);
+  Py_CLEAR(self->errors);
+  if (self->writebuf) {
+    PyMem_Free(self->writebuf);
+    self->writebuf = NULL;
+  }
   return -1;
 }
 
+/* Support function: WriteObject
+   Passes data to write() of fileobj. A write() that returns a count less
+   than the length of data is treated as an error, since the rest would be
+   lost.
+ */
+static unsigned char
+WriteObject(Writer *self, PyObject *data) {
+  Py_ssize_t written;
+  PyObject *ret = PyObject_CallFunctionObjArgs(self->writefunc, data, NULL);
+  if (!ret) return 0;
+  if (ret == Py_None || !PyLong_Check(ret)) {
+    Py_DECREF(ret);
+    return 1;
+  }
+  written = PyLong_AsSsize_t(ret);
+  Py_DECREF(ret);
+  if (written == -1 && PyErr_Occurred()) return 0;
+  if (written < PyObject_Length(data)) {
+    PyErr_Format(PyExc_IOError, "write() wrote only %zd of %zd",
+                 written, PyObject_Length(data));
+    return 0;
+  }
+  return 1;
+}
+
+/* Support function: Writer_lock
+   Takes the lock of a Writer of a file descriptor. Another thread waits
+   for it without the GIL. A call from the thread that holds it, such as
+   writerow in __str__ of a cell, raises RuntimeError.
+ */
+static unsigned char
+Writer_lock(Writer *self) {
+  const unsigned long ident = PyThread_get_thread_ident();
+  if (!self->lock) return 1;
+  if (!PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+    if (self->lock_owner == ident) {
+      PyErr_SetString(PyExc_RuntimeError, "reentrant call to Writer");
+      return 0;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+  }
+  self->lock_owner = ident;
+  return 1;
+}
+
+static void
+Writer_unlock(Writer *self) {
+  if (!self->lock) return;
+  self->lock_owner = 0;
+  PyThread_release_lock(self->lock);
+}
+
+/* Support function: RaiseWriteError
+   Raises OSError of the errno returned by the flusher.
+ */
+static unsigned char
+RaiseWriteError(int error) {
+  errno = error;
+  PyErr_SetFromErrno(PyExc_OSError);
+  return 0;
+}
+
+/* Support function: Writer_flush_internal
+   Writes the buffered characters. Returns 0 with the exception of write()
+   on error, and keeps the characters so that flush can be retried.
+ */
 static unsigned char
 Writer_flush_internal(Writer *self) {
+  if (self->flusher) {
+    if (self->writebuf_start != 0) {
+      const int error = FastCSV_FlusherSubmit(self->flusher,
+                                              self->writebuf_start);
+      if (error) return RaiseWriteError(error);
+      self->writebuf = FastCSV_FlusherBuffer(self->flusher);
+      self->writebuf_start = 0;
+    }
+    return 1;
+  }
   if (self->writebuf_start != 0) {
-    PyObject *ret = PyObject_CallFunction(
-        self->writefunc, "u#", self->writebuf, self->writebuf_start);
-    if (!ret) {
+    unsigned char ok;
+    PyObject *str = self->codec
+      ? PyBytes_FromStringAndSize(self->writebuf, self->writebuf_start)
+      : PyUnicode_FromKindAndData(self->writebuf_kind, self->writebuf,
+                                  self->writebuf_start);
+    if (!str) {
+      return 0;
+    }
+    ok = WriteObject(self, str);
+    Py_DECREF(str);
+    if (!ok) {
       return 0;
     }
-    Py_DECREF(ret);
     self->writebuf_start = 0;
+    self->writebuf_kind = PyUnicode_1BYTE_KIND;
   }
   return 1;
 }
 
 static PyObject *
 Writer_flush(Writer *self) {
-  if (!Writer_flush_internal(self)) {
-    return NULL;
-  } else {
-    Py_RETURN_NONE;
+  unsigned char ok;
+  if (!Writer_lock(self)) return NULL;
+  ok = Writer_flush_internal(self);
+  if (ok && self->flusher) {
+    const int error = FastCSV_FlusherWait(self->flusher);
+    if (error) ok = RaiseWriteError(error);
   }
+  Writer_unlock(self);
+  if (!ok) return NULL;
+  Py_RETURN_NONE;
 }
 
 static void
 Writer_dealloc(Writer *self) {
   Py_XDECREF(self->fileobj);
-  PyMem_Del(self->writebuf);
+  Py_XDECREF(self->writefunc);
+  Py_XDECREF(self->newline);
+  Py_XDECREF(self->errors);
+  if (self->flusher) {
+    /* Flush the rest, as a buffered file does. There is no one to raise
+       the error to. */
+    if (self->writebuf_start != 0) {
+      FastCSV_FlusherSubmit(self->flusher, self->writebuf_start);
+    }
+    FastCSV_StopFlusher(self->flusher);
+  } else if (self->writebuf) {
+    PyMem_Free(self->writebuf);
+  }
+  if (self->lock) PyThread_free_lock(self->lock);
+  Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
 static PyObject *
@@ -167,96 +445,470 @@ Writer___enter__(Writer *self, PyObject *args) {
   return (PyObject *) self;
 }
 
+static PyObject *
+Writer_close(Writer *self) {
+  if (self->flusher) {
+    /* The thread writes the rest before it stops. */
+    int error = 0, stop_error;
+    if (!Writer_lock(self)) return NULL;
+    if (!self->flusher) {
+      /* Closed by another thread while this one waited. */
+      Writer_unlock(self);
+      Py_RETURN_NONE;
+    }
+    if (self->writebuf_start != 0) {
+      error = FastCSV_FlusherSubmit(self->flusher, self->writebuf_start);
+    }
+    stop_error = FastCSV_StopFlusher(self->flusher);
+    self->flusher = NULL;
+    self->writebuf = NULL;
+    self->writebuf_start = 0;
+    Writer_unlock(self);
+    if (error || stop_error) {
+      RaiseWriteError(error ? error : stop_error);
+      return NULL;
+    }
+    Py_RETURN_NONE;
+  }
+  {
+    /* The file is closed even if the flush fails, and the error of the
+       flush is raised rather than the one of close. */
+    const unsigned char flushed = Writer_flush_internal(self);
+    PyObject *exc_type, *exc_value, *exc_tb;
+    PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+    if (PyObject_HasAttrString(self->fileobj, "close")) {
+      PyObject *ret = PyObject_CallMethod(self->fileobj, "close", NULL);
+      if (!ret && flushed) {
+        return NULL;
+      }
+      Py_XDECREF(ret);
+    }
+    if (!flushed) {
+      PyErr_Restore(exc_type, exc_value, exc_tb);
+      return NULL;
+    }
+  }
+  Py_RETURN_NONE;
+}
+
 static PyObject *
 Writer___exit__(Writer *self, PyObject *args) {
   if (!self->entered) {
     PyErr_SetString(PyExc_Exception, "have not entered but tried to exit");
     return NULL;
   }
-  Writer_flush_internal(self);
-  if (PyObject_HasAttrString(self->fileobj, "close")) {
-    PyObject *ret = PyObject_CallMethod(self->fileobj, "close", NULL);
-    if (!ret) {
-      return NULL;
+  return Writer_close(self);
+}
+
+
+/* Support function: WidenWriteBuffer
+   Converts the characters in writebuf to the wider kind in place. It walks
+   from the end so that no character is overwritten before it is read.
+ */
+static void
+WidenWriteBuffer(Writer *self, int kind) {
+  Py_ssize_t i = self->writebuf_start;
+  if (self->writebuf_kind == PyUnicode_1BYTE_KIND) {
+    const Py_UCS1 *from = (const Py_UCS1 *)self->writebuf;
+    if (kind == PyUnicode_2BYTE_KIND) {
+      Py_UCS2 *to = (Py_UCS2 *)self->writebuf;
+      while (i-- > 0) to[i] = from[i];
+    } else {
+      Py_UCS4 *to = (Py_UCS4 *)self->writebuf;
+      while (i-- > 0) to[i] = from[i];
     }
-    Py_DECREF(ret);
+  } else {
+    const Py_UCS2 *from = (const Py_UCS2 *)self->writebuf;
+    Py_UCS4 *to = (Py_UCS4 *)self->writebuf;
+    while (i-- > 0) to[i] = from[i];
   }
-  Py_RETURN_NONE;
+  self->writebuf_kind = kind;
 }
 
+/* Support function: CopyChars
+   Copies size characters of the given kind into writebuf at writebuf_start.
+   writebuf_kind should be equal or wider than kind.
+ */
+static void
+CopyChars(Writer *self, const void *data, int kind, Py_ssize_t size) {
+  char *to = (char *)self->writebuf +
+    self->writebuf_start * self->writebuf_kind;
+  const char *from = (const char *)data;
 
+  if (kind == self->writebuf_kind) {
+    memcpy(to, from, size * kind);
+  } else if (kind == PyUnicode_1BYTE_KIND) {
+    if (self->writebuf_kind == PyUnicode_2BYTE_KIND) {
+      FASTCSV_CONVERT_CHARS(Py_UCS1, Py_UCS2, from, from + size, to);
+    } else {
+      FASTCSV_CONVERT_CHARS(Py_UCS1, Py_UCS4, from, from + size, to);
+    }
+  } else {
+    FASTCSV_CONVERT_CHARS(Py_UCS2, Py_UCS4, from, from + size * 2, to);
+  }
+  self->writebuf_start += size;
+}
+
+/* Support function: Writer_writebytes
+   Writes raw bytes in bytes mode, in the same way as Writer_writechars.
+ */
 static unsigned char
-Writer_writestr(Writer *self, PyObject *str) {
-  Py_UNICODE *buf = PyUnicode_AS_UNICODE(str);
-  Py_ssize_t size = PyUnicode_GET_SIZE(str);
-  Py_ssize_t i = 0;
+Writer_writebytes(Writer *self, const char *data, Py_ssize_t size) {
+  const Py_ssize_t capacity = self->writebuf_cap * sizeof(Py_UCS4);
 
-  if (size == 0) return 1;
+  if (size > capacity - self->writebuf_start) {
+    if (!Writer_flush_internal(self)) return 0;
+    while (size > capacity && self->flusher) {
+      memcpy(self->writebuf, data, capacity);
+      self->writebuf_start = capacity;
+      if (!Writer_flush_internal(self)) return 0;
+      data += capacity;
+      size -= capacity;
+    }
+    if (size > capacity) {
+      unsigned char ok;
+      PyObject *bytes = PyBytes_FromStringAndSize(data, size);
+      if (!bytes) return 0;
+      ok = WriteObject(self, bytes);
+      Py_DECREF(bytes);
+      return ok;
+    }
+  }
+  memcpy((char *)self->writebuf + self->writebuf_start, data, size);
+  self->writebuf_start += size;
+  return 1;
+}
+
+/* Support function: Writer_encodechars
+   Encodes size characters into writebuf with the built-in encoder, by
+   pieces that fit in writebuf. A piece that has a character the encoder
+   does not support is encoded by the Python codec with the error handler.
+ */
+static unsigned char
+Writer_encodechars(Writer *self, const char *data, int kind, Py_ssize_t size)
+{
+  const FastCSV_Codec *codec = self->codec;
+  const Py_ssize_t capacity = self->writebuf_cap * sizeof(Py_UCS4);
+  const Py_ssize_t max_chunk = capacity / codec->max_char_bytes;
 
-  while (i != size) {
-    if (self->writebuf_start == self->writebuf_cap) {
-      Writer_flush_internal(self);
+  while (size > 0) {
+    const Py_ssize_t chunk = (size < max_chunk) ? size : max_chunk;
+    Py_ssize_t written;
+    if (chunk * codec->max_char_bytes > capacity - self->writebuf_start &&
+        !Writer_flush_internal(self)) {
+      return 0;
+    }
+    written = codec->encode(codec, kind, data, chunk,
+                            (char *)self->writebuf + self->writebuf_start);
+    if (written >= 0) {
+      self->writebuf_start += written;
+    } else {
+      PyObject *str, *bytes;
+      const char *errors;
+      unsigned char ok;
+      errors = PyUnicode_AsUTF8(self->errors);
+      if (!errors) return 0;
+      str = PyUnicode_FromKindAndData(kind, data, chunk);
+      if (!str) return 0;
+      bytes = PyUnicode_AsEncodedString(str, codec->fallback, errors);
+      Py_DECREF(str);
+      if (!bytes) return 0;
+      ok = Writer_writebytes(self, PyBytes_AS_STRING(bytes),
+                             PyBytes_GET_SIZE(bytes));
+      Py_DECREF(bytes);
+      if (!ok) return 0;
     }
+    data += chunk * kind;
+    size -= chunk;
+  }
+  return 1;
+}
 
-    self->writebuf[(self->writebuf_start)++] = buf[i++];
+/* Support function: Writer_writechars
+   Writes size characters of the given PEP 393 kind. They are copied into
+   writebuf at once, after flushing it if they do not fit. If str is given,
+   it has the characters, and is written through if it does not fit in an
+   empty writebuf either. In bytes mode, they are encoded instead.
+ */
+static unsigned char
+Writer_writechars(Writer *self, const void *data, int kind, Py_ssize_t size,
+                  PyObject *str)
+{
+  if (size == 0) return 1;
+  if (self->codec) return Writer_encodechars(self, data, kind, size);
+
+  if (size > self->writebuf_cap - self->writebuf_start) {
+    if (!Writer_flush_internal(self)) return 0;
+    if (size > self->writebuf_cap) {
+      unsigned char ok;
+      if (str) return WriteObject(self, str);
+      str = PyUnicode_FromKindAndData(kind, data, size);
+      if (!str) return 0;
+      ok = WriteObject(self, str);
+      Py_DECREF(str);
+      return ok;
+    }
+  }
+  if (kind > self->writebuf_kind) {
+    WidenWriteBuffer(self, kind);
   }
+  CopyChars(self, data, kind, size);
   return 1;
 }
 
+static unsigned char
+Writer_writestr(Writer *self, PyObject *str) {
+  if (FASTCSV_READY(str) < 0) return 0;
+  return Writer_writechars(self, PyUnicode_DATA(str), PyUnicode_KIND(str),
+                           PyUnicode_GET_LENGTH(str), str);
+}
+
+/* Support function: FormatLongLong
+   Writes the digits of v backward from end, and returns the first one.
+ */
+static char *
+FormatLongLong(long long v, char *end) {
+  unsigned long long u = (v < 0) ? 0ULL - (unsigned long long)v
+                                 : (unsigned long long)v;
+  do {
+    *--end = (char)('0' + u % 10);
+    u /= 10;
+  } while (u);
+  if (v < 0) *--end = '-';
+  return end;
+}
+
+/* Support function: FormatDigits
+   Writes v in width digits with leading zeros, and returns the end.
+ */
+static char *
+FormatDigits(char *p, int v, int width) {
+  int i;
+  for (i = width - 1; i >= 0; i--) {
+    p[i] = (char)('0' + v % 10);
+    v /= 10;
+  }
+  return p + width;
+}
+
+/* Support function: FormatDate
+   Writes a date, or a datetime without tzinfo, in the same way as str().
+ */
+static char *
+FormatDate(PyObject *cell, char *p) {
+  p = FormatDigits(p, PyDateTime_GET_YEAR(cell), 4);
+  *p++ = '-';
+  p = FormatDigits(p, PyDateTime_GET_MONTH(cell), 2);
+  *p++ = '-';
+  p = FormatDigits(p, PyDateTime_GET_DAY(cell), 2);
+  if (!PyDateTime_CheckExact(cell)) return p;
+  *p++ = ' ';
+  p = FormatDigits(p, PyDateTime_DATE_GET_HOUR(cell), 2);
+  *p++ = ':';
+  p = FormatDigits(p, PyDateTime_DATE_GET_MINUTE(cell), 2);
+  *p++ = ':';
+  p = FormatDigits(p, PyDateTime_DATE_GET_SECOND(cell), 2);
+  if (PyDateTime_DATE_GET_MICROSECOND(cell)) {
+    *p++ = '.';
+    p = FormatDigits(p, PyDateTime_DATE_GET_MICROSECOND(cell), 6);
+  }
+  return p;
+}
+
+/* Support function: Writer_writeformatted
+   Formats an int, float, bool, date or datetime without tzinfo into
+   writebuf directly. Their characters never need quotes, so they are not
+   scanned. Returns -1 if the cell is none of them, that is, str() should
+   be used instead. Subclasses are not formatted here since they may
+   override __str__.
+ */
+static int
+Writer_writeformatted(Writer *self, PyObject *cell,
+                      unsigned char force_quote)
+{
+  char buf[FORMAT_BUFFER_SIZE];
+  const char *s;
+  char *end = buf + sizeof(buf);
+  char *formatted = NULL;
+  PyObject *str = NULL;
+  unsigned char ok;
+
+  if (PyLong_CheckExact(cell)) {
+    int overflow;
+    const long long v = PyLong_AsLongLongAndOverflow(cell, &overflow);
+    if (overflow) {
+      /* A big int still has only digits. */
+      str = PyObject_Str(cell);
+      if (!str) return 0;
+      s = end = NULL;
+    } else {
+      if (v == -1 && PyErr_Occurred()) return 0;
+      s = FormatLongLong(v, end);
+    }
+  } else if (PyFloat_CheckExact(cell)) {
+    if (self->float_precision < 0) {
+      formatted = PyOS_double_to_string(PyFloat_AS_DOUBLE(cell), 'r', 0,
+                                        Py_DTSF_ADD_DOT_0, NULL);
+    } else {
+      formatted = PyOS_double_to_string(PyFloat_AS_DOUBLE(cell), 'f',
+                                        self->float_precision, 0, NULL);
+    }
+    if (!formatted) return 0;
+    s = formatted;
+    end = formatted + strlen(formatted);
+  } else if (PyBool_Check(cell)) {
+    s = (cell == Py_True) ? "True" : "False";
+    end = (char *)s + strlen(s);
+  } else if (PyDate_CheckExact(cell) ||
+             (PyDateTime_CheckExact(cell) &&
+              !((_PyDateTime_BaseTZInfo *)cell)->hastzinfo)) {
+    s = buf;
+    end = FormatDate(cell, buf);
+  } else {
+    return -1;
+  }
+
+  ok = (!force_quote ||
+        Writer_writechars(self, "\"", PyUnicode_1BYTE_KIND, 1, NULL)) &&
+       (str ? Writer_writestr(self, str)
+            : Writer_writechars(self, s, PyUnicode_1BYTE_KIND, end - s,
+                                NULL)) &&
+       (!force_quote ||
+        Writer_writechars(self, "\"", PyUnicode_1BYTE_KIND, 1, NULL));
+  Py_XDECREF(str);
+  if (formatted) PyMem_Free(formatted);
+  return ok;
+}
+
+/* Support function: Writer_writelazy
+   Writes the cells of a lazy row as they were in the record, without
+   creating nor escaping them.
+ */
+static unsigned char
+Writer_writelazy(Writer *self, FastCSV_LazyRow *row) {
+  unsigned char ok;
+  PyObject *text;
+
+  if (!row->codec) {
+    return Writer_writechars(self, row->data, row->kind, row->size, NULL);
+  }
+  if (self->codec && strcmp(row->codec->fallback, self->codec->fallback) == 0) {
+    /* The raw bytes are already in the encoding. */
+    return Writer_writebytes(self, row->data, row->size);
+  }
+  /* The raw bytes are decoded at once. */
+  text = FastCSV_LazyRowText(row);
+  if (!text) return 0;
+  ok = Writer_writestr(self, text);
+  Py_DECREF(text);
+  return ok;
+}
+
+/* Support function: Writer_writeescaped
+   Writes a cell in one scan. The scan finds the first special character
+   to decide whether the cell is quoted, and then every quote, and the
+   characters between them are copied as they are. Nothing is scanned
+   twice, and no string is created.
+ */
+static unsigned char
+Writer_writeescaped(Writer *self, PyObject *str, unsigned char force_quote,
+                    unsigned char only_cell)
+{
+  const void *data;
+  int kind;
+  Py_ssize_t size, start = 0, pos = 0;
+  FastCSV_FindFunc find;
+
+  if (FASTCSV_READY(str) < 0) return 0;
+  data = PyUnicode_DATA(str);
+  kind = PyUnicode_KIND(str);
+  size = PyUnicode_GET_LENGTH(str);
+  find = fastcsv_scanner->find[FASTCSV_KIND_INDEX(kind)];
+
+  if (!force_quote) {
+    pos = find(data, 0, size, &self->special_set);
+    /* An empty row would be read as no cell. */
+    if (pos == size && !(only_cell && size == 0)) {
+      return Writer_writechars(self, data, kind, size, str);
+    }
+    if (self->quoting == QUOTE_NONE) {
+      PyErr_SetString(PyExc_ValueError,
+                      "cell should be quoted but quoting is 'none'");
+      return 0;
+    }
+  }
+
+  if (!Writer_writechars(self, "\"", PyUnicode_1BYTE_KIND, 1, NULL)) {
+    return 0;
+  }
+  /* Copy up to every quote and write one more. */
+  while ((pos = find(data, pos, size, &self->quote_set)) < size) {
+    pos++;
+    if (!Writer_writechars(self, (const char *)data + start * kind, kind,
+                           pos - start, NULL) ||
+        !Writer_writechars(self, "\"", PyUnicode_1BYTE_KIND, 1, NULL)) {
+      return 0;
+    }
+    start = pos;
+  }
+  return Writer_writechars(self, (const char *)data + start * kind, kind,
+                           size - start, start ? NULL : str) &&
+         Writer_writechars(self, "\"", PyUnicode_1BYTE_KIND, 1, NULL);
+}
+
 static unsigned char
 Writer_writecell(Writer *self, PyObject *cell,
-                 unsigned char need_escape, unsigned char first_cell)
+                 unsigned char only_cell, unsigned char first_cell)
 {
-  unsigned char free_cellstr = 0;
-  unsigned char free_replaced = 0;
-  PyObject *cellstr = NULL;
-  PyObject *replaced = NULL;
+  unsigned char force_quote = (self->quoting == QUOTE_ALL);
+  unsigned char ok;
+  int ret;
+  PyObject *cellstr;
 
-  if (!first_cell && !Writer_writestr(self, comma_string))
-    goto error_exit;
+  if (!first_cell &&
+      !Writer_writechars(self, ",", PyUnicode_1BYTE_KIND, 1, NULL)) {
+    return 0;
+  }
 
+  if (self->quoting == QUOTE_NONNUMERIC) {
+    force_quote = !PyNumber_Check(cell);
+  }
   if (PyUnicode_Check(cell)) {
-    cellstr = cell;
+    return Writer_writeescaped(self, cell, force_quote, only_cell);
   } else if (cell == Py_None) {
-    if (need_escape) {
-      return Writer_writestr(self, twoquote_string);
+    if (force_quote || (only_cell && self->quoting == QUOTE_MINIMAL)) {
+      return Writer_writechars(self, "\"\"", PyUnicode_1BYTE_KIND, 2, NULL);
     }
-    return 1;
-  } else {
-#if PY_MAJOR_VERSION >= 3
-    cellstr = PyObject_Str(cell);
-#else
-    cellstr = PyObject_Unicode(cell);
-#endif
-    if (!cellstr) {
-      PyErr_SetString(PyExc_ValueError, "cell value is not unicode");
-      goto error_exit;
+    if (only_cell) {
+      PyErr_SetString(PyExc_ValueError,
+                      "cell should be quoted but quoting is 'none'");
+      return 0;
     }
-    free_cellstr = 1;
+    return 1;
   }
 
-  if (need_escape && !Writer_writestr(self, quote_string)) goto error_exit;
-  replaced = PyUnicode_Replace(cellstr, quote_string, twoquote_string, -1);
-  if (!replaced) goto error_exit;
-  free_replaced = 1;
-  if (!Writer_writestr(self, replaced)) goto error_exit;
-  if (need_escape && !Writer_writestr(self, quote_string)) goto error_exit;
-
-  if (free_cellstr) Py_DECREF(cellstr);
-  if (free_replaced) Py_DECREF(replaced);
-  return 1;
+  ret = Writer_writeformatted(self, cell, force_quote);
+  if (ret >= 0) return (unsigned char)ret;
 
-error_exit:
-  if (free_cellstr) Py_DECREF(cellstr);
-  if (free_replaced) Py_DECREF(replaced);
-  return 0;
+  cellstr = PyObject_Str(cell);
+  if (!cellstr) {
+    PyErr_SetString(PyExc_ValueError, "cell value is not unicode");
+    return 0;
+  }
+  ok = Writer_writeescaped(self, cellstr, force_quote, only_cell);
+  Py_DECREF(cellstr);
+  return ok;
 }
 
 static unsigned char
-Writer_writerow_internal(Writer *self, PyObject *arg) {
-  unsigned char need_escape = 0;
-
-  if (PySequence_Check(arg)) {
+Writer_writerow_unlocked(Writer *self, PyObject *arg) {
+  if (!self->writebuf) {
+    PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+    return 0;
+  }
+  if (FastCSV_LazyRow_Check(arg)) {
+    if (!Writer_writelazy(self, (FastCSV_LazyRow *)arg)) return 0;
+  } else if (PySequence_Check(arg)) {
     PyObject *sequence;
     Py_ssize_t size, i;
 
@@ -264,17 +916,9 @@ Writer_writerow_internal(Writer *self, PyObject *arg) {
     if (!sequence) return 0;
     size = PySequence_Fast_GET_SIZE(sequence);
 
-    if (self->strict) {
-      PyErr_SetString(PyExc_NotImplementedError, "not implemented");
-      Py_DECREF(sequence);
-      return 0;
-    } else {
-      need_escape = 1;
-    }
-
     for (i = 0; i < size; i++) {
       if (!Writer_writecell(self, PySequence_Fast_GET_ITEM(sequence, i),
-                            need_escape, (i == 0))) {
+                            (size == 1), (i == 0))) {
         Py_DECREF(sequence);
         return 0;
       }
@@ -282,39 +926,42 @@ Writer_writerow_internal(Writer *self, PyObject *arg) {
     Py_DECREF(sequence);
   } else {
     unsigned char first_cell = 1;
+    PyObject *cell, *next;
     PyObject *iter = PyObject_GetIter(arg);
     if (!iter) return 0;
 
-    if (self->strict) {
-      PyErr_SetString(PyExc_NotImplementedError, "not implemented");
-      Py_DECREF(iter);
-      return 0;
-    } else {
-      need_escape = 1;
-    }
-
-    while (1) {
-      PyObject *cell = PyIter_Next(iter);
-      if (!cell) {
-        if (PyErr_Occurred()) {
-          Py_DECREF(iter);
-          return 0;
-        } else {
-          break;
-        }
-      }
-
-      if (!Writer_writecell(self, cell, need_escape, first_cell)) {
+    /* The next cell is taken in advance to know the only cell. */
+    cell = PyIter_Next(iter);
+    while (cell) {
+      next = PyIter_Next(iter);
+      if (!next && PyErr_Occurred()) {
+        Py_DECREF(cell);
         Py_DECREF(iter);
+        return 0;
+      }
+      if (!Writer_writecell(self, cell, (first_cell && !next), first_cell)) {
         Py_DECREF(cell);
+        Py_XDECREF(next);
+        Py_DECREF(iter);
         return 0;
       }
-      first_cell = 0;
       Py_DECREF(cell);
+      cell = next;
+      first_cell = 0;
     }
+    Py_DECREF(iter);
+    if (PyErr_Occurred()) return 0;
   }
-  Writer_writestr(self, self->newline);
-  return 1;
+  return Writer_writestr(self, self->newline);
+}
+
+static unsigned char
+Writer_writerow_internal(Writer *self, PyObject *arg) {
+  unsigned char ok;
+  if (!Writer_lock(self)) return 0;
+  ok = Writer_writerow_unlocked(self, arg);
+  Writer_unlock(self);
+  return ok;
 }
 
 static PyObject *
@@ -374,12 +1021,56 @@ Writer_writerows(Writer *self, PyObject *arg) {
   }
 }
 
+/* Writer.open(path, append=False, **kwargs)
+   Opens path and returns a Writer of the file descriptor. The other keyword
+   arguments are passed to Writer.
+ */
+static PyObject *
+Writer_open(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  PyObject *path = NULL;
+  PyObject *writer_kwds = NULL;
+  PyObject *value;
+  PyObject *writer = NULL;
+  int append = 0;
+  int fd = -1;
+
+  if (!PyArg_ParseTuple(args, "O", &path)) return NULL;
+  writer_kwds = kwds ? PyDict_Copy(kwds) : PyDict_New();
+  if (!writer_kwds) return NULL;
+  if ((value = PyDict_GetItemString(writer_kwds, "append"))) {
+    append = PyObject_IsTrue(value);
+    if (append < 0) goto error_exit;
+    if (PyDict_DelItemString(writer_kwds, "append") < 0) goto error_exit;
+  }
+  if (PyDict_SetItemString(writer_kwds, "closefd", Py_True) < 0) {
+    goto error_exit;
+  }
+
+  fd = FastCSV_OpenForWrite(path, (unsigned char)append);
+  if (fd < 0) goto error_exit;
+  value = Py_BuildValue("(i)", fd);
+  if (!value) goto error_exit;
+  writer = PyObject_Call((PyObject *)type, value, writer_kwds);
+  Py_DECREF(value);
+  if (!writer) goto error_exit;
+  Py_DECREF(writer_kwds);
+  return writer;
+
+error_exit:
+  if (fd >= 0) close(fd);
+  Py_XDECREF(writer_kwds);
+  return NULL;
+}
+
 static PyMethodDef Writer_methods[] = {
   { "__enter__", (PyCFunction)Writer___enter__, METH_NOARGS },
   { "__exit__", (PyCFunction)Writer___exit__, METH_VARARGS },
   { "writerow", (PyCFunction)Writer_writerow, METH_O },
   { "writerows", (PyCFunction)Writer_writerows, METH_O },
   { "flush", (PyCFunction)Writer_flush, METH_NOARGS },
+  { "close", (PyCFunction)Writer_close, METH_NOARGS },
+  { "open", (PyCFunction)Writer_open,
+    METH_VARARGS | METH_KEYWORDS | METH_CLASS },
   {NULL}
 };
 
@@ -403,13 +1094,7 @@ PyTypeObject WriterType = {
   0,                          /* tp_getattro */
   0,                          /* tp_setattro */
   0,                          /* tp_as_buffer */
-  Py_TPFLAGS_DEFAULT
-#if PY_MAJOR_VERSION >= 3
-    // Py_TPFLAGS_HAVE_ITER is deprecated in Python3.
-#else
-    | Py_TPFLAGS_HAVE_ITER
-#endif
-    , /* tp_flags */
+  Py_TPFLAGS_DEFAULT,         /* tp_flags */
   "FastCSV Writer Object",    /* tp_doc */
   0,                          /* tp_traverse */
   0,                          /* tp_clear */
@@ -1,5 +1,117 @@
 # -*- coding: utf-8 -*-
 from __future__ import division, absolute_import, print_function, unicode_literals
 
+import asyncio
+import os
+
 from _fastcsv import Reader, Writer
 
+def parse_parallel(path, threads=None, **kwargs):
+    """Return a Reader of the file at path that finds the cells on threads.
+
+    threads defaults to the number of CPUs. The other arguments are passed
+    to Reader.from_path.
+    """
+    if threads is None:
+        threads = os.cpu_count() or 1
+    return Reader.from_path(path, threads=threads, **kwargs)
+
+def build_index(path, every=10000, index_path=None, **kwargs):
+    """Write the offsets of every every-th record of the file at path.
+
+    index_path defaults to path + '.idx'. Pass it as the index argument of
+    Reader.from_path to let Reader.seek_row jump near the row. The other
+    arguments are passed to Reader.from_path, and newline and encoding
+    should be the same when the index is used. Returns index_path.
+    """
+    if index_path is None:
+        path = os.fspath(path)
+        index_path = path + (b'.idx' if isinstance(path, bytes) else '.idx')
+    with Reader.from_path(path, **kwargs) as reader:
+        reader.write_index(index_path, every)
+    return index_path
+
+def DictReader(fileobj, fieldnames=None, restkey=None, restval=None,
+               **kwargs):
+    """Return a Reader whose rows are dicts, like csv.DictReader.
+
+    If fieldnames is None, the first row is read as the fieldnames. The
+    other arguments are passed to Reader.
+    """
+    return Reader(fileobj, row_type=dict, fieldnames=fieldnames,
+                  restkey=restkey, restval=restval, **kwargs)
+
+class AsyncReader(object):
+    """Read rows asynchronously from an object with an awaitable read().
+
+    Use it with async for. The data is read by read(read_size) and parsed by
+    Reader.feed, so stream can be an asyncio.StreamReader for example. Up to
+    row_budget rows are parsed in a step, and the event loop runs other
+    tasks between the steps. The other arguments are passed to Reader.
+    """
+
+    def __init__(self, stream, read_size=64 * 1024, row_budget=1000,
+                 **kwargs):
+        if read_size < 1 or row_budget < 1:
+            raise ValueError('read_size and row_budget should be positive')
+        self._stream = stream
+        self._read_size = read_size
+        self._row_budget = row_budget
+        self._reader = Reader(None, **kwargs)
+        self._rows = []
+        self._index = 0
+        self._fed = False
+        self._eof = False
+
+    @property
+    def reader(self):
+        """The Reader that parses the data."""
+        return self._reader
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self):
+        while self._index == len(self._rows):
+            self._index = 0
+            # Reading before the first feed would let the Reader see the
+            # end of the data.
+            if self._fed:
+                self._rows = self._reader.read_rows(self._row_budget)
+            if self._rows:
+                # The rows of the data already read. Let the other tasks run
+                # before parsing them.
+                await asyncio.sleep(0)
+            elif self._eof:
+                raise StopAsyncIteration
+            else:
+                chunk = await self._stream.read(self._read_size)
+                self._fed = True
+                if chunk:
+                    self._rows = self._reader.feed(chunk, self._row_budget)
+                else:
+                    self._eof = True
+                    self._rows = self._reader.close()
+        row = self._rows[self._index]
+        self._index += 1
+        return row
+
+def read_columns(fileobj, batch_size=None, **kwargs):
+    """Read the CSV file into one list per column.
+
+    The other arguments are passed to Reader. If batch_size is given, this
+    returns an iterator that yields the columns of every batch_size rows.
+    """
+    reader = Reader(fileobj, **kwargs)
+    if batch_size is None:
+        return reader.read_columns()
+    if batch_size < 1:
+        raise ValueError('batch_size should be positive')
+    return _iter_column_batches(reader, batch_size)
+
+def _iter_column_batches(reader, batch_size):
+    while True:
+        columns = reader.read_columns(batch_size)
+        if not columns:
+            return
+        yield columns
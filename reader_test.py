@@ -1,8 +1,30 @@
 # -*- coding: utf-8 -*-
 from __future__ import division, absolute_import, print_function, unicode_literals
 import unittest
+import asyncio
+import csv
+import datetime
 import io
+import os
+import random
+import tempfile
 import fastcsv
+import _fastcsv
+
+def random_csv(rand, chars):
+    rows = []
+    for i in range(rand.randint(1, 20)):
+        cells = []
+        for j in range(rand.randint(1, 10)):
+            cell = ''.join(rand.choices(chars, k=rand.randint(0, 150)))
+            if rand.random() < 0.3:
+                cell = '"' + cell.replace('"', '""') + '"'
+            else:
+                cell = cell.replace('"', '').replace(',', '')
+                cell = cell.replace('\r', '').replace('\n', '')
+            cells.append(cell)
+        rows.append(','.join(cells))
+    return rand.choice(['\n', '\r', '\r\n']).join(rows) + '\n'
 
 class ReaderTest(unittest.TestCase):
 
@@ -51,6 +73,955 @@ class ReaderTest(unittest.TestCase):
         result = list(fastcsv.Reader(inp))
         self.assertEqual(result, expected)
 
+    def it_reads_non_latin1_cells(self):
+        source = ['"\u3042,\u3044","\U0001f600"""',
+                  '\xe9,\u3046\U0001f600,abc']
+        expected = [["\u3042,\u3044", "\U0001f600\""],
+                    ["\xe9", "\u3046\U0001f600", "abc"]]
+        result = list(fastcsv.Reader(io.StringIO('\n'.join(source) + '\n')))
+        self.assertEqual(result, expected)
+
+    def it_joins_cells_of_different_kinds_across_the_buffer(self):
+        inp = io.StringIO('"' + ('a' * 1020) + '\u3042\U0001f600"\n')
+        expected = [['a' * 1020 + '\u3042\U0001f600']]
+        result = list(fastcsv.Reader(inp))
+        self.assertEqual(result, expected)
+
+    def it_unescapes_doubled_quotes_of_every_kind(self):
+        for c in ('a', '\u3042', '\U0001f600'):
+            cell = ('"' + c) * 500 + '\r\n' + c
+            inp = io.StringIO('"' + cell.replace('"', '""') + '",x\n',
+                              newline='')
+            result = list(fastcsv.Reader(inp))
+            self.assertEqual(result, [[cell, 'x']])
+
+class EncodingTest(unittest.TestCase):
+
+    def it_decodes_utf8_cells(self):
+        source = '"\u3042,\u3044","\U0001f600"""\r\n\xe9,' + 'a' * 1022 + '\u3046\n'
+        expected = [["\u3042,\u3044", "\U0001f600\""],
+                    ["\xe9", 'a' * 1022 + "\u3046"]]
+        inp = io.BytesIO(source.encode('utf-8'))
+        result = list(fastcsv.Reader(inp, encoding='utf-8'))
+        self.assertEqual(result, expected)
+
+    def it_decodes_cp932_cells_whose_trail_byte_is_ascii(self):
+        # The trail bytes of \u30bd and \u8868 are 0x5c.
+        source = ['\u30bd\u8868,"\u30bd,\uff71"', '\u8868' * 600]
+        expected = [['\u30bd\u8868', '\u30bd,\uff71'], ['\u8868' * 600]]
+        inp = io.BytesIO('\r\n'.join(source).encode('cp932') + b'\r\n')
+        result = list(fastcsv.Reader(inp, encoding='cp932'))
+        self.assertEqual(result, expected)
+
+    def it_matches_str_input(self):
+        rand = random.Random(932)
+        alphabet = ['a', ',', '"', '\r', '\n', '\\', '\u3042', '\u30bd',
+                    '\uff71', '\u2460']
+        for i in range(50):
+            text = random_csv(rand, alphabet)
+            expected = list(fastcsv.Reader(io.StringIO(text, newline='')))
+            for encoding in ('utf-8', 'cp932'):
+                inp = io.BytesIO(text.encode(encoding))
+                result = list(fastcsv.Reader(inp, encoding=encoding))
+                self.assertEqual(expected, result)
+
+    def it_skips_the_bom(self):
+        inp = io.BytesIO(b'\xef\xbb\xbfabc,def\n')
+        result = list(fastcsv.Reader(inp, encoding='utf-8-sig'))
+        self.assertEqual(result, [['abc', 'def']])
+
+    def it_raises_UnicodeDecodeError_for_invalid_bytes(self):
+        with self.assertRaises(UnicodeDecodeError):
+            list(fastcsv.Reader(io.BytesIO(b'a,\x82,c\n'), encoding='cp932'))
+        with self.assertRaises(UnicodeDecodeError):
+            list(fastcsv.Reader(io.BytesIO(b'a,\xff\n'), encoding='utf-8'))
+
+    def it_applies_the_error_handler(self):
+        inp = io.BytesIO(b'a,\x82,\xe3\x81\x82\n')
+        result = list(fastcsv.Reader(inp, encoding='cp932', errors='replace'))
+        self.assertEqual(result, [['a', '\ufffd', '\u7e3a\ufffd']])
+
+    def it_rejects_unsupported_encoding(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.BytesIO(b''), encoding='utf-16')
+        with self.assertRaises(LookupError):
+            fastcsv.Reader(io.BytesIO(b''), encoding='no-such-encoding')
+
+    def it_raises_TypeError_if_read_returns_str(self):
+        with self.assertRaises(TypeError):
+            list(fastcsv.Reader(io.StringIO('a\n'), encoding='utf-8'))
+        with self.assertRaises(TypeError):
+            list(fastcsv.Reader(io.BytesIO(b'a\n')))
+
+class BufferTest(unittest.TestCase):
+
+    def read_all(self, inp, **kwargs):
+        rows = []
+        try:
+            for row in fastcsv.Reader(inp, **kwargs):
+                rows.append(row)
+        except (ValueError, IOError) as e:
+            rows.append(repr(e))
+        return rows
+
+    def it_carries_over_records_across_small_buffers(self):
+        rand = random.Random(4)
+        alphabet = ['a', ',', '"', '\r', '\n', '\xe9', '\u3042', '\U0001f600']
+        for i in range(100):
+            if i % 2:
+                text = random_csv(rand, alphabet)
+            else:
+                text = ''.join(rand.choices(alphabet, k=rand.randint(0, 300)))
+            expected = self.read_all(io.StringIO(text, newline=''))
+            for size in (1, 2, 3, 7, 64):
+                inp = io.StringIO(text, newline='')
+                self.assertEqual(expected, self.read_all(inp, buffer_size=size))
+                inp = io.BytesIO(text.encode('utf-8'))
+                self.assertEqual(expected, self.read_all(inp, buffer_size=size,
+                                                         encoding='utf-8'))
+
+    def it_keeps_a_lone_cr_at_the_buffer_end_in_crlf_mode(self):
+        inputs = ['a\rb\r\n', '"a"\r\nb\r\n', 'a,b\rc\r\nd\r\n']
+        expects = [[['a\rb']], [['a'], ['b']], [['a'], ['d']]]
+        for text, expected in zip(inputs, expects):
+            for size in (1, 2, 3, 64):
+                reader = fastcsv.Reader(io.StringIO(text, newline=''),
+                                        newline='\r\n', buffer_size=size,
+                                        usecols=[0])
+                self.assertEqual(expected, list(reader))
+        reader = fastcsv.Reader(None, newline='\r\n')
+        self.assertEqual(reader.feed('a\r'), [])
+        self.assertEqual(reader.feed('b\r'), [])
+        self.assertEqual(reader.feed('\n'), [['a\rb']])
+        self.assertEqual(reader.close(), [])
+
+    def it_reads_with_read_if_readinto_is_missing(self):
+        class ReadOnly(object):
+            def __init__(self, data):
+                self.inp = io.BytesIO(data)
+            def read(self, size):
+                return self.inp.read(size)
+        data = '\ufeffabc,"d\r\n""e"\r\n\u3042\r\n'.encode('utf-8')
+        expected = [['abc', 'd\r\n"e'], ['\u3042']]
+        for size in (1, 5, 1024):
+            result = list(fastcsv.Reader(ReadOnly(data), encoding='utf-8-sig',
+                                         buffer_size=size))
+            self.assertEqual(expected, result)
+
+    def it_raises_BlockingIOError_if_no_data_is_available(self):
+        class NonBlocking(io.RawIOBase):
+            def __init__(self, data):
+                self.inp = io.BytesIO(data)
+                self.ready = False
+            def readable(self):
+                return True
+            def readinto(self, b):
+                self.ready = not self.ready
+                return self.inp.readinto(b) if self.ready else None
+        reader = fastcsv.Reader(NonBlocking(b'ab,c\nd\n'), encoding='utf-8',
+                                buffer_size=3)
+        rows = []
+        while True:
+            try:
+                rows.append(next(reader))
+            except BlockingIOError:
+                continue
+            except StopIteration:
+                break
+        self.assertEqual(rows, [['ab', 'c'], ['d']])
+
+    def it_raises_IOError_for_an_unterminated_record(self):
+        with self.assertRaises(IOError):
+            list(fastcsv.Reader(io.StringIO('a,"b\n'), buffer_size=2))
+
+    def it_rejects_non_positive_buffer_size(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.StringIO(''), buffer_size=0)
+
+class FromPathTest(unittest.TestCase):
+
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp()
+        os.close(fd)
+
+    def tearDown(self):
+        os.remove(self.path)
+
+    def write(self, data):
+        with open(self.path, 'wb') as f:
+            f.write(data)
+
+    def it_reads_the_mapped_file(self):
+        rand = random.Random(6)
+        alphabet = ['a', ',', '"', '\r', '\n', '\u3042', '\u30bd']
+        for i in range(20):
+            text = random_csv(rand, alphabet)
+            expected = list(fastcsv.Reader(io.StringIO(text, newline='')))
+            for encoding in ('utf-8', 'cp932'):
+                self.write(text.encode(encoding))
+                reader = fastcsv.Reader.from_path(self.path, encoding=encoding)
+                self.assertEqual(expected, list(reader))
+
+    def it_skips_the_bom(self):
+        self.write(b'\xef\xbb\xbfabc,def\r\n')
+        reader = fastcsv.Reader.from_path(self.path, encoding='utf-8-sig')
+        self.assertEqual(list(reader), [['abc', 'def']])
+
+    def it_resumes_after_stopping_at_a_record(self):
+        self.write(b'a,b\nc,d\ne,f\n')
+        with fastcsv.Reader.from_path(self.path) as reader:
+            self.assertEqual(next(reader), ['a', 'b'])
+            self.assertEqual(list(reader), [['c', 'd'], ['e', 'f']])
+        self.assertEqual(list(reader), [])
+
+    def it_reads_an_empty_file(self):
+        self.assertEqual(list(fastcsv.Reader.from_path(self.path)), [])
+
+    def it_raises_OSError_for_a_missing_file(self):
+        with self.assertRaises(OSError):
+            fastcsv.Reader.from_path(self.path + '.missing')
+
+    def read_all(self, reader):
+        rows = []
+        while True:
+            try:
+                rows.append(next(reader))
+            except StopIteration:
+                return rows
+            except (ValueError, IOError) as e:
+                rows.append(repr(e))
+
+    def it_parses_in_parallel(self):
+        rand = random.Random(7)
+        alphabet = ['a', ',', '"', '\r', '\n', '\u3042']
+        for i in range(100):
+            if i % 2:
+                text = random_csv(rand, alphabet)
+            else:
+                text = ''.join(rand.choices(alphabet, k=rand.randint(0, 300)))
+            self.write(text.encode('utf-8'))
+            for newline in (None, '\n', '\r', '\r\n'):
+                expected = self.read_all(
+                    fastcsv.Reader.from_path(self.path, newline=newline))
+                for threads, chunk_size in ((2, 1), (3, 7), (4, 64)):
+                    reader = fastcsv.parse_parallel(self.path, threads,
+                                                    newline=newline,
+                                                    chunk_size=chunk_size)
+                    self.assertEqual(expected, self.read_all(reader))
+
+    def it_skips_columns_in_parallel(self):
+        rand = random.Random(11)
+        alphabet = ['a', ',', '"', '\r', '\n']
+        for i in range(30):
+            text = random_csv(rand, alphabet)
+            self.write(text.encode('utf-8'))
+            expected = list(fastcsv.Reader.from_path(self.path, usecols=[1]))
+            reader = fastcsv.parse_parallel(self.path, 3, usecols=[1],
+                                            chunk_size=8)
+            self.assertEqual(expected, list(reader))
+
+class IndexTest(unittest.TestCase):
+
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp()
+        os.close(fd)
+        self.index_path = self.path + '.idx'
+
+    def tearDown(self):
+        os.remove(self.path)
+        if os.path.exists(self.index_path):
+            os.remove(self.index_path)
+
+    def write(self, data):
+        with open(self.path, 'wb') as f:
+            f.write(data)
+
+    def it_seeks_to_any_row_with_an_index(self):
+        rand = random.Random(12)
+        alphabet = ['a', ',', '"', '\r', '\n', '\u3042']
+        for i in range(30):
+            text = random_csv(rand, alphabet)
+            self.write(text.encode('utf-8'))
+            try:
+                expected = list(fastcsv.Reader.from_path(self.path))
+            except (ValueError, IOError):
+                continue
+            every = rand.randint(1, 4)
+            self.assertEqual(fastcsv.build_index(self.path, every=every),
+                             self.index_path)
+            reader = fastcsv.Reader.from_path(self.path,
+                                              index=self.index_path)
+            for row in rand.sample(range(len(expected) + 2),
+                                   len(expected) + 2):
+                self.assertEqual(reader.seek_row(row),
+                                 min(row, len(expected)))
+                self.assertEqual(list(reader), expected[row:])
+
+    def it_finds_records_across_quoted_lineendings(self):
+        self.write(b'\xef\xbb\xbfa,"x\ny"\nb,"\n"\nc,d\ne,f\n')
+        fastcsv.build_index(self.path, every=1, encoding='utf-8-sig')
+        reader = fastcsv.Reader.from_path(self.path, encoding='utf-8-sig',
+                                          index=self.index_path)
+        reader.seek_row(2)
+        self.assertEqual(next(reader), ['c', 'd'])
+        reader.seek_row(0)
+        self.assertEqual(next(reader), ['a', 'x\ny'])
+
+    def it_seeks_without_an_index(self):
+        self.write(b'a,b\nc,d\ne,f\n')
+        reader = fastcsv.Reader.from_path(self.path)
+        reader.seek_row(2)
+        self.assertEqual(next(reader), ['e', 'f'])
+        reader.seek_row(1)
+        self.assertEqual(next(reader), ['c', 'd'])
+
+    def it_counts_the_header_as_row_0(self):
+        self.write(b'x,y\n1,2\n3,4\n')
+        reader = fastcsv.Reader.from_path(self.path, row_type=dict)
+        reader.seek_row(2)
+        self.assertEqual(next(reader), {'x': '3', 'y': '4'})
+
+    def it_seeks_forward_in_a_file_object(self):
+        reader = fastcsv.Reader(io.StringIO('a\nb\nc\n'))
+        self.assertEqual(reader.seek_row(2), 2)
+        self.assertEqual(list(reader), [['c']])
+        with self.assertRaises(ValueError):
+            reader.seek_row(0)
+
+    def it_seeks_forward_in_a_fed_reader(self):
+        reader = fastcsv.Reader(None)
+        self.assertEqual(reader.feed('a\nb\nc\n'), [['a'], ['b'], ['c']])
+        with self.assertRaises(ValueError):
+            reader.seek_row(0)
+        with self.assertRaises(ValueError):
+            reader.write_index(self.index_path, 1)
+
+    def it_rejects_a_stale_index(self):
+        self.write(b'a\nb\nc\n')
+        fastcsv.build_index(self.path, every=1)
+        self.write(b'a\nb\nc\nd\n')
+        with self.assertRaises(ValueError):
+            fastcsv.Reader.from_path(self.path, index=self.index_path)
+        with open(self.index_path, 'wb') as f:
+            f.write(b'garbage')
+        with self.assertRaises(ValueError):
+            fastcsv.Reader.from_path(self.path, index=self.index_path)
+
+class CheckpointTest(unittest.TestCase):
+
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp()
+        os.close(fd)
+
+    def tearDown(self):
+        os.remove(self.path)
+
+    def write(self, data, mode='wb'):
+        with open(self.path, mode) as f:
+            f.write(data)
+
+    def it_tells_the_offset_of_the_next_record(self):
+        reader = fastcsv.Reader(io.BytesIO(b'a,b\n"c\n",d\ne\n'),
+                                encoding='utf-8', buffer_size=2)
+        self.assertEqual(reader.tell(), (0, 0, False))
+        next(reader)
+        self.assertEqual(reader.tell(), (4, 1, False))
+        next(reader)
+        self.assertEqual(reader.tell(), (11, 2, False))
+
+    def it_tells_characters_in_str_mode(self):
+        reader = fastcsv.Reader(io.StringIO('\u3042,b\nc\n'))
+        next(reader)
+        self.assertEqual(reader.tell(), (4, 1, False))
+
+    def it_resumes_a_binary_file(self):
+        rand = random.Random(13)
+        alphabet = ['a', ',', '"', '\r', '\n', '\u3042']
+        for i in range(50):
+            text = random_csv(rand, alphabet)
+            data = text.encode('utf-8')
+            try:
+                expected = list(fastcsv.Reader(io.BytesIO(data),
+                                               encoding='utf-8'))
+            except (ValueError, IOError):
+                continue
+            stop = rand.randint(0, len(expected))
+            reader = fastcsv.Reader(io.BytesIO(data), encoding='utf-8',
+                                    buffer_size=rand.randint(1, 8))
+            rows = [next(reader) for j in range(stop)]
+            checkpoint = reader.tell()
+            resumed = fastcsv.Reader(io.BytesIO(data), encoding='utf-8',
+                                     resume=checkpoint)
+            self.assertEqual(rows + list(resumed), expected)
+            self.assertEqual(resumed.tell()[1], len(expected))
+
+    def it_keeps_CR_at_the_end_of_the_data(self):
+        self.write(b'a\r')
+        with open(self.path, 'rb') as f:
+            reader = fastcsv.Reader(f, encoding='utf-8')
+            self.assertEqual(list(reader), [['a']])
+            checkpoint = reader.tell()
+        self.assertEqual(checkpoint, (2, 1, True))
+        self.write(b'\nb\r\n', 'ab')
+        with open(self.path, 'rb') as f:
+            reader = fastcsv.Reader(f, encoding='utf-8', resume=checkpoint)
+            self.assertEqual(list(reader), [['b']])
+        reader = fastcsv.Reader.from_path(self.path, resume=checkpoint)
+        self.assertEqual(list(reader), [['b']])
+
+    def it_follows_an_appended_file(self):
+        self.write(b'x,y\n1,2\n')
+        reader = fastcsv.Reader.from_path(self.path, row_type=dict)
+        self.assertEqual(list(reader), [{'x': '1', 'y': '2'}])
+        checkpoint = reader.tell()
+        self.write(b'3,4\n5,6\n', 'ab')
+        for threads in (1, 2):
+            reader = fastcsv.Reader.from_path(self.path, row_type=dict,
+                                              resume=checkpoint,
+                                              threads=threads, chunk_size=2)
+            self.assertEqual(list(reader), [{'x': '3', 'y': '4'},
+                                            {'x': '5', 'y': '6'}])
+            self.assertEqual(reader.tell(), (16, 4, False))
+
+    def it_tells_in_parallel(self):
+        self.write(b'a,b\n"c\n",d\ne\nf\n')
+        reader = fastcsv.Reader.from_path(self.path, threads=2, chunk_size=3)
+        offsets = []
+        for row in reader:
+            offsets.append(reader.tell()[0])
+        self.assertEqual(offsets, [4, 11, 13, 15])
+
+    def it_rejects_invalid_checkpoints(self):
+        self.write(b'a\n')
+        with self.assertRaises(ValueError):
+            fastcsv.Reader.from_path(self.path, resume=(10, 1, False))
+        with self.assertRaises(ValueError):
+            fastcsv.Reader.from_path(self.path, resume='0')
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.StringIO('a\n'), resume=(0, 0, False))
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.BytesIO(b'a\n'), encoding='utf-8',
+                           row_type=dict, resume=(2, 1, False))
+
+class FeedTest(unittest.TestCase):
+
+    def feed_all(self, reader, data, rand):
+        rows = []
+        i = 0
+        while i < len(data):
+            n = rand.randint(0, 5)
+            rows.extend(reader.feed(data[i:i + n]))
+            i += n
+        rows.extend(reader.close())
+        return rows
+
+    def it_matches_reading_the_whole_text(self):
+        rand = random.Random(14)
+        alphabet = ['a', ',', '"', '\r', '\n', '\u3042', '\U0001f600']
+        for i in range(100):
+            text = random_csv(rand, alphabet)
+            try:
+                expected = list(fastcsv.Reader(io.StringIO(text,
+                                                           newline='')))
+            except (ValueError, IOError):
+                continue
+            reader = fastcsv.Reader(None)
+            self.assertEqual(self.feed_all(reader, text, rand), expected)
+
+    def it_splits_multibyte_characters_and_the_bom(self):
+        rand = random.Random(15)
+        data = '\ufeffa,\u3042\r\n"\u30bd\n",b\r\n'.encode('utf-8')
+        for i in range(20):
+            reader = fastcsv.Reader(None, encoding='utf-8-sig')
+            self.assertEqual(self.feed_all(reader, data, rand),
+                             [['a', '\u3042'], ['\u30bd\n', 'b']])
+
+    def it_returns_complete_rows_only(self):
+        reader = fastcsv.Reader(None)
+        self.assertEqual(reader.feed('a,"b\n'), [])
+        self.assertEqual(reader.feed('c",d\ne,'), [['a', 'b\nc', 'd']])
+        self.assertEqual(list(reader), [])
+        self.assertEqual(reader.feed('f\r'), [['e', 'f']])
+        self.assertEqual(reader.feed('\ng\n'), [['g']])
+        self.assertEqual(reader.close(), [])
+
+    def it_flags_truncated_input_on_close(self):
+        reader = fastcsv.Reader(None)
+        self.assertEqual(reader.feed('a,"b'), [])
+        with self.assertRaises(IOError):
+            reader.close()
+
+    def it_rejects_feeding_a_file_reader_or_a_closed_one(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.StringIO('a\n')).feed('b\n')
+        reader = fastcsv.Reader(None)
+        self.assertEqual(reader.close(), [])
+        with self.assertRaises(ValueError):
+            reader.feed('a\n')
+        with self.assertRaises(TypeError):
+            fastcsv.Reader(None).feed(b'a\n')
+
+class AsyncReaderTest(unittest.TestCase):
+
+    class Stream(object):
+        def __init__(self, data):
+            self.data = data
+            self.reads = 0
+
+        async def read(self, size):
+            self.reads += 1
+            chunk, self.data = self.data[:3], self.data[3:]
+            return chunk
+
+    def run_async(self, coro):
+        loop = asyncio.new_event_loop()
+        try:
+            return loop.run_until_complete(coro)
+        finally:
+            loop.close()
+
+    def it_iterates_the_rows_of_an_async_stream(self):
+        stream = self.Stream(b'\xef\xbb\xbfa,"b\n"\r\n\xe3\x81\x82,c\n')
+        async def collect():
+            return [row async for row in
+                    fastcsv.AsyncReader(stream, encoding='utf-8-sig')]
+        self.assertEqual(self.run_async(collect()),
+                         [['a', 'b\n'], ['\u3042', 'c']])
+
+    def it_lets_other_tasks_run_between_steps(self):
+        text = ''.join('%d,x\n' % i for i in range(1000))
+        async def count_steps():
+            stream = asyncio.StreamReader()
+            stream.feed_data(text.encode('ascii'))
+            stream.feed_eof()
+            steps = []
+            async def ticker():
+                while True:
+                    steps.append(len(rows))
+                    await asyncio.sleep(0)
+            rows = []
+            task = asyncio.ensure_future(ticker())
+            async for row in fastcsv.AsyncReader(stream, encoding='ascii',
+                                                 row_budget=100):
+                rows.append(row)
+            task.cancel()
+            return rows, steps
+        rows, steps = self.run_async(count_steps())
+        self.assertEqual(len(rows), 1000)
+        self.assertEqual(rows[999], ['999', 'x'])
+        self.assertGreaterEqual(len(set(steps)), 9)
+
+    def it_raises_the_errors_of_the_data(self):
+        async def collect():
+            return [row async for row in
+                    fastcsv.AsyncReader(self.Stream('a,"b'))]
+        with self.assertRaises(IOError):
+            self.run_async(collect())
+
+class ReadRowsTest(unittest.TestCase):
+
+    def it_reads_rows_by_batch(self):
+        rows = [[str(i), 'x' * i] for i in range(10)]
+        text = ''.join(','.join(row) + '\n' for row in rows)
+        reader = fastcsv.Reader(io.StringIO(text), buffer_size=3)
+        self.assertEqual(reader.read_rows(4), rows[:4])
+        self.assertEqual(next(reader), rows[4])
+        self.assertEqual(reader.read_rows(0), [])
+        self.assertEqual(reader.read_rows(4), rows[5:9])
+        self.assertEqual(reader.read_rows(4), rows[9:])
+        self.assertEqual(reader.read_rows(4), [])
+
+    def it_reads_all_the_rest(self):
+        reader = fastcsv.Reader(io.StringIO('a,b\nc\n"d\n",e\n'))
+        self.assertEqual(next(reader), ['a', 'b'])
+        self.assertEqual(reader.read_all(), [['c'], ['d\n', 'e']])
+        self.assertEqual(reader.read_all(), [])
+
+    def it_rejects_negative_counts(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.StringIO('')).read_rows(-1)
+
+class RowTypeTest(unittest.TestCase):
+
+    source = 'a,b,c\nd\ne,f\n'
+    expected = [['a', 'b', 'c'], ['d'], ['e', 'f']]
+
+    def it_returns_tuples(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), row_type=tuple)
+        self.assertEqual(list(reader), [tuple(row) for row in self.expected])
+
+    def it_accepts_the_names_of_the_types(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), row_type='tuple')
+        self.assertIsInstance(next(reader), tuple)
+        reader = fastcsv.Reader(io.StringIO(self.source), row_type='list')
+        self.assertIsInstance(next(reader), list)
+
+    def it_reuses_the_row_that_is_not_kept(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), row_type='reuse')
+        ids = []
+        for row in self.expected:
+            got = next(reader)
+            self.assertEqual(got, row)
+            ids.append(id(got))
+            del got
+        self.assertEqual(len(set(ids)), 1)
+
+    def it_does_not_reuse_the_row_that_is_kept(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), row_type='reuse')
+        self.assertEqual(list(reader), self.expected)
+        reader = fastcsv.Reader(io.StringIO(self.source), row_type='reuse')
+        self.assertEqual(reader.read_all(), self.expected)
+
+    def it_rejects_unknown_types(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.StringIO(''), row_type=set)
+
+class DictReaderTest(unittest.TestCase):
+
+    def it_reads_the_header_as_the_keys(self):
+        reader = fastcsv.DictReader(io.StringIO('a,b\n1,2\n3,4\n'))
+        self.assertIsNone(reader.fieldnames)
+        self.assertEqual(list(reader), [{'a': '1', 'b': '2'},
+                                        {'a': '3', 'b': '4'}])
+        self.assertEqual(reader.fieldnames, ['a', 'b'])
+
+    def it_matches_csv_DictReader(self):
+        text = 'a,b,c\n1,2\n3,4,5,6,7\n8,9,10\n'
+        for kwargs in ({}, {'restkey': 'rest', 'restval': '-'},
+                       {'fieldnames': ['x', 'y']}):
+            expected = list(csv.DictReader(io.StringIO(text), **kwargs))
+            got = list(fastcsv.DictReader(io.StringIO(text), **kwargs))
+            self.assertEqual([dict(row) for row in expected], got)
+
+    def it_shares_the_keys(self):
+        reader = fastcsv.DictReader(io.StringIO('k' + 'ey\n1\n2\n'))
+        first, second = list(reader)
+        self.assertIs(list(first)[0], list(second)[0])
+
+    def it_selects_and_converts_columns(self):
+        reader = fastcsv.DictReader(io.StringIO('a,b,c\n1,2,3\n4,5,6\n'),
+                                    usecols=['c', 'a'],
+                                    schema=['int64', None, 'int64'],
+                                    where=[('b', '==', '5')])
+        self.assertEqual(list(reader), [{'c': 6, 'a': 4}])
+
+    def it_requires_row_type_dict_for_fieldnames(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.StringIO(''), fieldnames=['a'])
+
+class LazyTest(unittest.TestCase):
+
+    source = 'a,"b""c",\n"d\ne",\u3042\n'
+
+    def it_creates_cells_on_access(self):
+        rows = list(fastcsv.Reader(io.StringIO(self.source), lazy=True))
+        self.assertIsInstance(rows[0], _fastcsv.LazyRow)
+        self.assertEqual(len(rows[0]), 3)
+        self.assertEqual(rows[0][1], 'b"c')
+        self.assertEqual(rows[0][-1], '')
+        self.assertEqual(rows[1][0], 'd\ne')
+        self.assertEqual(list(rows[1]), ['d\ne', '\u3042'])
+        self.assertEqual(rows, list(fastcsv.Reader(io.StringIO(self.source))))
+        with self.assertRaises(IndexError):
+            rows[1][2]
+
+    def it_keeps_the_raw_cells(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), lazy=True,
+                                buffer_size=2)
+        self.assertEqual([row.raw for row in reader],
+                         ['a,"b""c",', '"d\ne",\u3042'])
+
+    def it_selects_columns(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), lazy=True,
+                                usecols=[1, 2])
+        rows = list(reader)
+        self.assertEqual(rows[0].raw, '"b""c",')
+        self.assertEqual(rows[1].tolist(), ['\u3042', None])
+        self.assertEqual(rows[1].raw, '\u3042,')
+
+    def it_decodes_cells_in_bytes_mode(self):
+        data = self.source.encode('cp932')
+        reader = fastcsv.Reader(io.BytesIO(data), encoding='cp932',
+                                lazy=True)
+        self.assertEqual(list(reader),
+                         list(fastcsv.Reader(io.StringIO(self.source))))
+
+    def it_rejects_schema(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.StringIO(''), lazy=True, schema=['int64'])
+
+    def it_rejects_intern(self):
+        for intern in (True, [0]):
+            with self.assertRaises(ValueError):
+                fastcsv.Reader(io.StringIO(''), lazy=True, intern=intern)
+
+class ColumnsTest(unittest.TestCase):
+
+    def it_reads_columns(self):
+        inp = io.StringIO('a,"b""",c\nd,e,f\n')
+        result = fastcsv.read_columns(inp)
+        self.assertEqual(result, [['a', 'd'], ['b"', 'e'], ['c', 'f']])
+
+    def it_pads_ragged_rows_with_None(self):
+        inp = io.StringIO('a\nb,c,d\ne,f\n')
+        result = fastcsv.read_columns(inp)
+        self.assertEqual(result, [['a', 'b', 'e'], [None, 'c', 'f'],
+                                  [None, 'd', None]])
+
+    def it_reads_columns_by_batch(self):
+        rows = [[str(i), 'x' * i] for i in range(10)]
+        text = ''.join(','.join(row) + '\n' for row in rows)
+        batches = list(fastcsv.read_columns(io.StringIO(text), batch_size=4,
+                                            buffer_size=3))
+        self.assertEqual([len(batch[0]) for batch in batches], [4, 4, 2])
+        for i, batch in enumerate(batches):
+            self.assertEqual(batch, [list(column) for column
+                                     in zip(*rows[i * 4:i * 4 + 4])])
+
+    def it_reads_columns_of_the_rest_of_the_rows(self):
+        reader = fastcsv.Reader(io.BytesIO(b'a,b\nc,d\ne,f\n'),
+                                encoding='utf-8')
+        self.assertEqual(next(reader), ['a', 'b'])
+        self.assertEqual(reader.read_columns(), [['c', 'e'], ['d', 'f']])
+        self.assertEqual(reader.read_columns(), [])
+
+class SchemaTest(unittest.TestCase):
+
+    def it_converts_typed_columns(self):
+        schema = ['int64', 'float64', 'bool', 'date:%Y/%m/%d', 'str']
+        source = ('-12,1.5e3,true,2013/1/02,007\n'
+                  '"9223372036854775807",-inf,0,1999/12/31,\n'
+                  ',,,,x\n')
+        expected = [[-12, 1500.0, True, datetime.date(2013, 1, 2), '007'],
+                    [9223372036854775807, float('-inf'), False,
+                     datetime.date(1999, 12, 31), ''],
+                    [None, None, None, None, 'x']]
+        for inp in (io.StringIO(source),
+                    io.BytesIO(source.encode('utf-8'))):
+            encoding = 'utf-8' if isinstance(inp, io.BytesIO) else None
+            result = list(fastcsv.Reader(inp, schema=schema,
+                                         encoding=encoding))
+            self.assertEqual(result, expected)
+
+    def it_leaves_columns_without_type_as_str(self):
+        inp = io.StringIO('1,2,3\n')
+        result = list(fastcsv.Reader(inp, schema=['int64', None]))
+        self.assertEqual(result, [[1, '2', '3']])
+
+    def it_reports_the_row_and_the_column(self):
+        inp = io.StringIO('1,2\n3,x4\n')
+        reader = fastcsv.Reader(inp, schema=['int64', 'int64'])
+        self.assertEqual(next(reader), [1, 2])
+        with self.assertRaisesRegex(ValueError, r"row 2, column 2: .*'x4'"):
+            next(reader)
+
+    def it_rejects_invalid_values(self):
+        cases = [('int64', '9223372036854775808'), ('int64', '1.0'),
+                 ('int64', '-'), ('float64', '1.0x'), ('float64', ' 1'),
+                 ('bool', 'yes'), ('date', '2013-02-30'),
+                 ('date', '2013-01-01x'), ('int64', '\u0661')]
+        for spec, cell in cases:
+            with self.assertRaises(ValueError):
+                list(fastcsv.Reader(io.StringIO(cell + '\n'), schema=[spec]))
+
+    def it_rejects_unknown_types(self):
+        for spec in ('int32', 'str:x', 'date:%H'):
+            with self.assertRaises(ValueError):
+                fastcsv.Reader(io.StringIO(''), schema=[spec])
+
+class UsecolsTest(unittest.TestCase):
+
+    def it_selects_columns_by_index(self):
+        inp = io.StringIO('a,b,c,d\ne,f,g,h\n')
+        reader = fastcsv.Reader(inp, usecols=[2, 0])
+        self.assertEqual(list(reader), [['c', 'a'], ['g', 'e']])
+
+    def it_selects_columns_by_name(self):
+        inp = io.StringIO('x,y,z\n1,2,3\n4,5,6\n')
+        reader = fastcsv.Reader(inp, usecols=['z', 0])
+        self.assertEqual(list(reader), [['z', 'x'], ['3', '1'], ['6', '4']])
+
+    def it_skips_quoted_cells_after_the_last_column(self):
+        text = 'a,"b\n,""c",d\r\n"e",f,"\r\n"\nh,"i,\n"\n'
+        expected = [row[:1] for row in fastcsv.Reader(io.StringIO(text))]
+        for buffer_size in (1, 2, 3, 1024):
+            reader = fastcsv.Reader(io.StringIO(text), usecols=[0],
+                                    buffer_size=buffer_size)
+            self.assertEqual(list(reader), expected)
+
+    def it_matches_slicing_the_rows(self):
+        rand = random.Random(10)
+        alphabet = ['a', ',', '"', '\r', '\n', '\u3042']
+        for i in range(50):
+            text = random_csv(rand, alphabet)
+            rows = list(fastcsv.Reader(io.StringIO(text, newline='')))
+            usecols = [1, 0, 3]
+            expected = [[row[j] if j < len(row) else None for j in usecols]
+                        for row in rows]
+            reader = fastcsv.Reader(io.StringIO(text, newline=''),
+                                    usecols=usecols, buffer_size=5)
+            self.assertEqual(list(reader), expected)
+
+    def it_converts_by_the_column_in_the_file(self):
+        inp = io.StringIO('1,2,3\n4,5,6\n')
+        reader = fastcsv.Reader(inp, usecols=[2, 1],
+                                schema=['str', 'str', 'int64'])
+        self.assertEqual(list(reader), [[3, '2'], [6, '5']])
+
+    def it_leaves_the_header_to_the_schema(self):
+        inp = io.StringIO('id,name,status\n1,a,OK\n2,b,NG\n')
+        reader = fastcsv.Reader(inp, usecols=['id', 'status'],
+                                schema=['int64'])
+        self.assertEqual(list(reader),
+                         [['id', 'status'], [1, 'OK'], [2, 'NG']])
+
+    def it_reads_columns(self):
+        inp = io.StringIO('a,b,c\nd,e,f\n')
+        result = fastcsv.read_columns(inp, usecols=['c', 'a'])
+        self.assertEqual(result, [['c', 'f'], ['a', 'd']])
+
+    def it_rejects_invalid_usecols(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Reader(io.StringIO(''), usecols=[-1])
+        with self.assertRaises(TypeError):
+            fastcsv.Reader(io.StringIO(''), usecols=[1.5])
+        with self.assertRaises(ValueError):
+            next(fastcsv.Reader(io.StringIO('a,b\n'), usecols=['c']))
+
+class WhereTest(unittest.TestCase):
+
+    source = ('id,status,region,price\n'
+              '1,OK,tokyo,10\n'
+              '2,FAILED,osaka,25.5\n'
+              '3,"FAI""LED",tokyo,x\n'
+              '4,FAILED,"to\nkyo",\n'
+              '5,FAILED,tokyo,-3\n')
+
+    def read(self, where, **kwargs):
+        return list(fastcsv.Reader(io.StringIO(self.source), where=where,
+                                   **kwargs))
+
+    def ids(self, where, **kwargs):
+        return [row[0] for row in self.read(where, **kwargs)[1:]]
+
+    def it_filters_by_equality(self):
+        self.assertEqual(self.ids([('status', '==', 'FAILED')]),
+                         ['2', '4', '5'])
+        self.assertEqual(self.read([(1, '==', 'FAI"LED')]),
+                         [['3', 'FAI"LED', 'tokyo', 'x']])
+
+    def it_filters_by_membership(self):
+        self.assertEqual(self.ids([('region', 'in', {'osaka', 'to\nkyo'})]),
+                         ['2', '4'])
+
+    def it_filters_by_prefix(self):
+        self.assertEqual(self.ids([('region', 'startswith', ('os', 'to\n'))]),
+                         ['2', '4'])
+
+    def it_filters_by_numeric_range(self):
+        self.assertEqual(self.ids([('price', 'between', (-3, 25.5))]),
+                         ['1', '2', '5'])
+        self.assertEqual(self.ids([('price', '>', 10)]), ['2'])
+        self.assertEqual(self.ids([('price', '<=', 10)]), ['1', '5'])
+
+    def it_requires_every_predicate(self):
+        where = [('status', '==', 'FAILED'), ('region', '==', 'tokyo')]
+        self.assertEqual(self.read(where, usecols=['id', 'price']),
+                         [['id', 'price'], ['5', '-3']])
+
+    def it_leaves_the_header_to_the_schema(self):
+        rows = self.read([('status', '==', 'OK')],
+                         schema=['int64', None, None, 'float64'])
+        self.assertEqual(rows, [['id', 'status', 'region', 'price'],
+                                [1, 'OK', 'tokyo', 10.0]])
+
+    def it_filters_the_first_row_if_every_column_is_an_index(self):
+        rows = list(fastcsv.Reader(io.StringIO('a,1\nb,2\n'),
+                                   where=[(1, '>=', 2)]))
+        self.assertEqual(rows, [['b', '2']])
+
+    def it_matches_encoded_values_in_bytes_mode(self):
+        data = '\u3042,1\n\u3044,2\n'.encode('cp932')
+        reader = fastcsv.Reader(io.BytesIO(data), encoding='cp932',
+                                where=[(0, '==', '\u3044')], buffer_size=3)
+        self.assertEqual(list(reader), [['\u3044', '2']])
+
+    def it_filters_in_parallel(self):
+        fd, path = tempfile.mkstemp()
+        try:
+            with os.fdopen(fd, 'w') as f:
+                f.write(self.source * 20)
+            where = [('status', 'in', ['FAILED'])]
+            expected = list(fastcsv.Reader.from_path(path, where=where))
+            reader = fastcsv.parse_parallel(path, 3, where=where,
+                                            chunk_size=16)
+            self.assertEqual(len(expected), 61)
+            self.assertEqual(list(reader), expected)
+        finally:
+            os.remove(path)
+
+    def it_rejects_invalid_predicates(self):
+        for where in ([('a', '~', 'b')], [('a', '==')], [(0, '==', 1)],
+                      [(-1, '==', 'a')], [(0, 'between', (1,))]):
+            with self.assertRaises((TypeError, ValueError)):
+                fastcsv.Reader(io.StringIO(''), where=where)
+
+class InternTest(unittest.TestCase):
+
+    source = 'JP,OK,1\nUS,OK,2\nJP,NG,3\nJP,OK,4\n'
+
+    def it_shares_the_str_of_the_same_cells(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), intern=[0])
+        rows = list(reader)
+        self.assertEqual(rows, list(fastcsv.Reader(io.StringIO(self.source))))
+        self.assertIs(rows[0][0], rows[2][0])
+        self.assertIs(rows[0][0], rows[3][0])
+        self.assertIsNot(rows[0][1], rows[1][1])
+        self.assertEqual(reader.intern_stats(),
+                         {0: {'hits': 2, 'misses': 2, 'size': 2}})
+
+    def it_interns_every_column(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), intern=True)
+        rows = list(reader)
+        self.assertIs(rows[0][1], rows[1][1])
+        self.assertEqual(sorted(reader.intern_stats()), [0, 1, 2])
+        self.assertEqual(reader.intern_stats()[2]['hits'], 0)
+
+    def it_stops_adding_values_at_the_limit(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), intern=[1, 2],
+                                intern_limit=1)
+        rows = list(reader)
+        self.assertIs(rows[0][1], rows[3][1])
+        self.assertEqual(rows[2][1], 'NG')
+        stats = reader.intern_stats()
+        self.assertEqual(stats[1], {'hits': 2, 'misses': 2, 'size': 1})
+        self.assertEqual(stats[2], {'hits': 0, 'misses': 4, 'size': 1})
+
+    def it_interns_by_name_in_bytes_mode(self):
+        data = 'k,v\n\u3042,"a""b"\n\u3042,"a""b"\n'.encode('utf-8')
+        reader = fastcsv.Reader(io.BytesIO(data), encoding='utf-8',
+                                intern=['k', 'v'], buffer_size=2)
+        rows = list(reader)
+        self.assertEqual(rows[1:], [['\u3042', 'a"b'], ['\u3042', 'a"b']])
+        self.assertIs(rows[1][0], rows[2][0])
+        self.assertIs(rows[1][1], rows[2][1])
+
+    def it_does_not_intern_the_header(self):
+        data = 'k,v\na,1\na,2\nb,3\n'
+        reader = fastcsv.Reader(io.StringIO(data), intern=['k'],
+                                intern_limit=1)
+        rows = list(reader)
+        self.assertEqual(rows[0], ['k', 'v'])
+        self.assertIs(rows[1][0], rows[2][0])
+        self.assertEqual(reader.intern_stats(),
+                         {0: {'hits': 1, 'misses': 2, 'size': 1}})
+
+    def it_leaves_typed_columns(self):
+        reader = fastcsv.Reader(io.StringIO(self.source), intern=True,
+                                schema=[None, None, 'int64'])
+        self.assertEqual([row[2] for row in reader], [1, 2, 3, 4])
+        self.assertNotIn(2, reader.intern_stats())
+
 class NewlineTest(unittest.TestCase):
 
     def it_is_converted_in_io(self):
@@ -99,3 +1070,37 @@ class NewlineTest(unittest.TestCase):
             result = list(fastcsv.Reader(io.StringIO(inputs[i], newline='')))
             self.assertEqual(expects[i], result)
 
+
+class ScannerTest(unittest.TestCase):
+
+    def read_with(self, scanner, text, newline):
+        prev = _fastcsv._set_scanner(scanner)
+        try:
+            inp = io.StringIO(text, newline='')
+            rows = []
+            try:
+                for row in fastcsv.Reader(inp, newline=newline):
+                    rows.append(row)
+            except (ValueError, IOError) as e:
+                rows.append(repr(e))
+            return rows
+        finally:
+            _fastcsv._set_scanner(prev)
+
+    def it_matches_the_scalar_scanner(self):
+        rand = random.Random(393)
+        alphabet = ['a', 'b', ',', '"', '\r', '\n', '\xe9', '\u3042',
+                    '\U0001f600']
+        scanners = _fastcsv._scanners()
+        self.assertIn('scalar', scanners)
+        for i in range(200):
+            chars = alphabet[:rand.randint(6, len(alphabet))]
+            if i % 2:
+                text = random_csv(rand, chars)
+            else:
+                text = ''.join(rand.choices(chars, k=rand.randint(0, 3000)))
+            for newline in (None, '\n', '\r', '\r\n'):
+                expected = self.read_with('scalar', text, newline)
+                for scanner in scanners:
+                    self.assertEqual(expected,
+                                     self.read_with(scanner, text, newline))
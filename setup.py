@@ -8,15 +8,31 @@ setup(
     description='fastcsv',
     classifiers=['Development Status :: 3 - Alpha',
                  'License :: OSI Approved :: BSD License',
+                 'Programming Language :: Python :: 3',
                  'Topic :: Text Processing'],
     author='Masaya SUZUKI',
     author_email='draftcode@gmail.com',
     url='https://github.com/draftcode/fastcsv',
     ext_modules=[Extension('_fastcsv',
                            sources=['_fastcsv.c',
+                                    '_fastcsv_codec.c',
+                                    '_fastcsv_convert.c',
+                                    '_fastcsv_filter.c',
+                                    '_fastcsv_flusher.c',
+                                    '_fastcsv_index.c',
+                                    '_fastcsv_intern.c',
+                                    '_fastcsv_mmap.c',
+                                    '_fastcsv_parallel.c',
+                                    '_fastcsv_parser.c',
                                     '_fastcsv_reader.c',
-                                    '_fastcsv_writer.c'])],
+                                    '_fastcsv_row.c',
+                                    '_fastcsv_scan.c',
+                                    '_fastcsv_writer.c'],
+                           depends=['_fastcsv.h',
+                                    '_fastcsv_scan.h',
+                                    '_fastcsv_seek.h'])],
     py_modules=['fastcsv'],
+    python_requires='>=3.6',
     test_suite='tests',
     test_loader='tests:RegexpPrefixLoader'
     )
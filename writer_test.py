@@ -1,7 +1,13 @@
 # -*- coding: utf-8 -*-
 from __future__ import division, absolute_import, print_function, unicode_literals
 import unittest
+import csv
+import datetime
 import io
+import os
+import random
+import tempfile
+import threading
 import fastcsv
 
 class TestIO(object):
@@ -132,3 +138,368 @@ class WriterTest(unittest.TestCase):
             writer.writerow(['"'])
         self.assertEqual(out.getvalue(), '""""\r\n')
 
+
+    def it_writes_non_latin1_cells(self):
+        out = TestIO()
+        with fastcsv.Writer(out) as writer:
+            writer.writerow(['abc', '\u3042', '\U0001f600', '\xe9'])
+            writer.writerow(['x' * 2000 + '\u3042'])
+        self.assertEqual(out.getvalue(),
+                         '"abc","\u3042","\U0001f600","\xe9"\r\n' +
+                         '"' + 'x' * 2000 + '\u3042"\r\n')
+
+    def it_writes_lazy_rows_verbatim(self):
+        source = 'a,"b""c",\r\n"d\ne",\u3042\r\n'
+        for encoding in (None, 'utf-8'):
+            if encoding:
+                inp = io.BytesIO(source.encode(encoding))
+            else:
+                inp = io.StringIO(source, newline='')
+            out = TestIO()
+            with fastcsv.Writer(out) as writer:
+                writer.writerows(fastcsv.Reader(inp, encoding=encoding,
+                                                lazy=True))
+            self.assertEqual(out.getvalue(), source)
+
+class BufferTest(unittest.TestCase):
+
+    class Recorder(object):
+        def __init__(self):
+            self.chunks = []
+        def write(self, data):
+            self.chunks.append(data)
+            return len(data)
+
+    def it_fills_the_buffer_before_writing(self):
+        out = self.Recorder()
+        writer = fastcsv.Writer(out, buffer_size=16)
+        writer.writerow(['abc'])
+        writer.writerow(['あ'])
+        self.assertEqual(out.chunks, [])
+        writer.writerow(['defg'])
+        self.assertEqual(out.chunks, ['"abc"\r\n"あ"\r\n"'])
+        writer.flush()
+        self.assertEqual(''.join(out.chunks),
+                         '"abc"\r\n"あ"\r\n"defg"\r\n')
+
+    def it_writes_a_large_cell_through(self):
+        out = self.Recorder()
+        cell = 'x' * 100 + '\U0001f600'
+        with fastcsv.Writer(out, buffer_size=16) as writer:
+            writer.writerow(['a', cell])
+        self.assertEqual(out.chunks, ['"a","', cell, '"\r\n'])
+        self.assertIs(out.chunks[1], cell)
+
+    def it_raises_the_errors_of_write(self):
+        class Failing(object):
+            def write(self, data):
+                raise IOError('disk full')
+        writer = fastcsv.Writer(Failing(), buffer_size=4)
+        with self.assertRaises(IOError):
+            writer.writerow(['abcdef'])
+        writer = fastcsv.Writer(Failing())
+        writer.writerow(['abc'])
+        with self.assertRaises(IOError):
+            writer.flush()
+        with self.assertRaises(IOError):
+            with fastcsv.Writer(Failing()) as writer:
+                writer.writerow(['abc'])
+
+    def it_raises_IOError_for_a_short_write(self):
+        class Short(object):
+            def write(self, data):
+                return len(data) - 1
+        writer = fastcsv.Writer(Short())
+        writer.writerow(['abc'])
+        with self.assertRaises(IOError):
+            writer.flush()
+
+    def it_rejects_non_positive_buffer_size(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Writer(io.StringIO(), buffer_size=0)
+
+class QuotingTest(unittest.TestCase):
+
+    def write(self, rows, **kwargs):
+        out = io.StringIO()
+        writer = fastcsv.Writer(out, **kwargs)
+        writer.writerows(rows)
+        writer.flush()
+        return out.getvalue()
+
+    def random_rows(self, rand):
+        values = ['', 'a', 'a,b', 'x"y', '"', 'p\rq', 'r\ns', ' t ',
+                  '\u3042"', 'x' * 40 + '"' + 'y' * 40, None, 0, -12,
+                  1.5, True]
+        return [[rand.choice(values) for j in range(rand.randint(1, 4))]
+                for i in range(rand.randint(1, 5))]
+
+    def it_matches_the_csv_module(self):
+        rand = random.Random(1)
+        for i in range(200):
+            rows = self.random_rows(rand)
+            for quoting in (csv.QUOTE_MINIMAL, csv.QUOTE_ALL,
+                            csv.QUOTE_NONNUMERIC):
+                out = io.StringIO()
+                csv.writer(out, lineterminator='\r\n',
+                           quoting=quoting).writerows(rows)
+                self.assertEqual(self.write(rows, quoting=quoting,
+                                            buffer_size=8),
+                                 out.getvalue())
+
+    def it_accepts_the_names_of_the_policies(self):
+        row = ['a', 'b,c', 1, None]
+        self.assertEqual(self.write([row], quoting='minimal'),
+                         'a,"b,c",1,\r\n')
+        self.assertEqual(self.write([row], quoting='all'),
+                         '"a","b,c","1",""\r\n')
+        self.assertEqual(self.write([row], quoting='nonnumeric'),
+                         '"a","b,c",1,""\r\n')
+        self.assertEqual(self.write([row[:1] + row[2:]], quoting='none'),
+                         'a,1,\r\n')
+        self.assertEqual(self.write([row], strict=True),
+                         'a,"b,c",1,\r\n')
+
+    def it_quotes_the_only_empty_cell(self):
+        self.assertEqual(self.write([[''], iter([None]), iter(['', ''])],
+                                    quoting='minimal'),
+                         '""\r\n""\r\n,\r\n')
+
+    def it_rejects_cells_that_need_quotes_without_quoting(self):
+        for row in (['a,b'], ['"'], [''], iter(['a\n'])):
+            with self.assertRaises(ValueError):
+                self.write([row], quoting='none')
+        with self.assertRaises(ValueError):
+            self.write([], quoting='some')
+
+class EncodingTest(unittest.TestCase):
+
+    rows = [['abc', 'a,b', 'x"y', '\xd7あ'], ['ア' * 300, 1, None],
+            ['～①']]
+
+    def write(self, rows, **kwargs):
+        out = io.BytesIO()
+        writer = fastcsv.Writer(out, **kwargs)
+        writer.writerows(rows)
+        writer.flush()
+        return out.getvalue()
+
+    def it_matches_the_encoded_text_output(self):
+        for encoding in ('utf-8', 'cp932', 'shift_jis'):
+            # shift_jis has no mapping of U+FF5E.
+            rows = self.rows[:2] if encoding == 'shift_jis' else self.rows
+            text = io.StringIO()
+            writer = fastcsv.Writer(text)
+            writer.writerows(rows)
+            writer.flush()
+            for buffer_size in (1, 7, 65536):
+                self.assertEqual(self.write(rows, encoding=encoding,
+                                            buffer_size=buffer_size),
+                                 text.getvalue().encode(encoding))
+
+    def it_encodes_all_characters_of_cp932(self):
+        chars = []
+        for c in range(0x80, 0x10000):
+            try:
+                chars.append(chr(c).encode('cp932') and chr(c))
+            except (UnicodeEncodeError, ValueError):
+                pass
+        row = [''.join(chars[i:i+100]) for i in range(0, len(chars), 100)]
+        self.assertEqual(self.write([row], encoding='cp932', quoting='none'),
+                         (','.join(row) + '\r\n').encode('cp932'))
+
+    def it_follows_the_error_policy(self):
+        with self.assertRaises(UnicodeEncodeError):
+            self.write([['aあ']], encoding='ascii')
+        with self.assertRaises(UnicodeEncodeError):
+            self.write([['\ud800']], encoding='utf-8')
+        self.assertEqual(self.write([['aあ', '\U0001f600']],
+                                    encoding='cp932', errors='replace'),
+                         b'"a\x82\xa0","?"\r\n')
+        self.assertEqual(self.write([['aあ']], encoding='latin-1',
+                                    errors='xmlcharrefreplace'),
+                         b'"a&#12354;"\r\n')
+
+    def it_writes_a_bom(self):
+        self.assertEqual(self.write([['a']], encoding='utf-8'), b'"a"\r\n')
+        self.assertEqual(self.write([['a']], encoding='utf-8', bom=True),
+                         b'\xef\xbb\xbf"a"\r\n')
+        self.assertEqual(self.write([['a']], encoding='utf-8-sig'),
+                         b'\xef\xbb\xbf"a"\r\n')
+        self.assertEqual(self.write([['a']], encoding='utf-8-sig', bom=False),
+                         b'"a"\r\n')
+        self.assertEqual(self.write([], encoding='utf-8', bom=True),
+                         b'\xef\xbb\xbf')
+        with self.assertRaises(ValueError):
+            self.write([], encoding='cp932', bom=True)
+        with self.assertRaises(ValueError):
+            fastcsv.Writer(io.StringIO(), bom=True)
+
+    def it_copies_lazy_rows_of_the_same_encoding(self):
+        source = 'a,"b""c",\r\n"d\ne",あ\r\n'
+        for encoding in ('utf-8', 'cp932'):
+            for out_encoding in ('utf-8', 'cp932'):
+                reader = fastcsv.Reader(io.BytesIO(source.encode(encoding)),
+                                        encoding=encoding, lazy=True)
+                self.assertEqual(self.write(reader, encoding=out_encoding),
+                                 source.encode(out_encoding))
+
+class FormattingTest(unittest.TestCase):
+
+    def write(self, row, **kwargs):
+        out = io.StringIO()
+        writer = fastcsv.Writer(out, **kwargs)
+        writer.writerow(row)
+        writer.flush()
+        return out.getvalue()
+
+    def it_formats_cells_same_as_str(self):
+        rand = random.Random(1)
+        class Int(int):
+            def __str__(self):
+                return 'int'
+        row = [0, -1, 2**63 - 1, -2**63, 2**63, -2**64, 7**200,
+               True, False, 0.0, -0.0, 1.5, 0.1, 1e16, 1e-7, 2.5e300,
+               float('inf'), float('-inf'), float('nan'),
+               datetime.date(1, 2, 3), datetime.date(2024, 12, 31),
+               datetime.datetime(2024, 1, 2, 3, 4, 5),
+               datetime.datetime(999, 1, 2, 3, 4, 5, 60),
+               datetime.datetime(2024, 1, 2, tzinfo=datetime.timezone.utc),
+               Int(3)]
+        row += [rand.randint(-2**70, 2**70) for i in range(50)]
+        row += [rand.uniform(-1e6, 1e6) for i in range(50)]
+        row += [rand.getrandbits(64) / 2 ** rand.randint(0, 200)
+                for i in range(50)]
+        for quoting in ('minimal', 'all', 'nonnumeric'):
+            out = io.StringIO()
+            csv.writer(out, lineterminator='\r\n',
+                       quoting=getattr(csv, 'QUOTE_' + quoting.upper())
+                       ).writerow(row)
+            self.assertEqual(self.write(row, quoting=quoting),
+                             out.getvalue())
+
+    def it_formats_floats_with_a_fixed_precision(self):
+        row = [1.0, -2.345, 1e20, 0.5, 1.5, 7]
+        self.assertEqual(self.write(row, quoting='minimal',
+                                    float_precision=2),
+                         '1.00,-2.35,100000000000000000000.00,0.50,1.50,7\r\n')
+        self.assertEqual(self.write(row[:1], float_precision=0),
+                         '"1"\r\n')
+        with self.assertRaises(ValueError):
+            fastcsv.Writer(io.StringIO(), float_precision=-1)
+
+class FileDescriptorTest(unittest.TestCase):
+
+    rows = [[i, 'x' * (i % 50), '\u3042"', None] for i in range(3000)]
+
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp()
+        os.close(fd)
+
+    def tearDown(self):
+        os.remove(self.path)
+
+    def read(self):
+        with open(self.path, 'rb') as f:
+            return f.read()
+
+    def expected(self, rows, **kwargs):
+        out = io.BytesIO()
+        writer = fastcsv.Writer(out, **kwargs)
+        writer.writerows(rows)
+        writer.flush()
+        return out.getvalue()
+
+    def it_writes_on_the_background_thread(self):
+        for buffer_size, queue_depth in ((1, 1), (16, 2), (65536, 4)):
+            with fastcsv.Writer.open(self.path, buffer_size=buffer_size,
+                                     queue_depth=queue_depth) as writer:
+                writer.writerows(self.rows)
+                writer.writerow(['y' * 1000])
+            self.assertEqual(self.read(),
+                             self.expected(self.rows + [['y' * 1000]],
+                                           encoding='utf-8'))
+
+    def it_appends_with_the_options_of_writer(self):
+        with fastcsv.Writer.open(self.path, encoding='utf-8-sig') as writer:
+            writer.writerow(['a'])
+        with fastcsv.Writer.open(self.path, append=True, encoding='cp932',
+                                 quoting='minimal', fsync=True) as writer:
+            writer.writerow(['\u3042', 1])
+            writer.flush()
+        self.assertEqual(self.read(),
+                         b'\xef\xbb\xbf"a"\r\n\x82\xa0,1\r\n')
+
+    def it_flushes_to_the_descriptor(self):
+        fd = os.open(self.path, os.O_WRONLY)
+        writer = fastcsv.Writer(fd, closefd=False)
+        writer.writerow(['a', 'b'])
+        self.assertEqual(self.read(), b'')
+        writer.flush()
+        self.assertEqual(self.read(), b'"a","b"\r\n')
+        writer.close()
+        os.write(fd, b'c')
+        os.close(fd)
+        self.assertEqual(self.read(), b'"a","b"\r\nc')
+        with self.assertRaises(ValueError):
+            writer.writerow(['d'])
+
+    def it_can_be_shared_by_threads(self):
+        writer = fastcsv.Writer.open(self.path, buffer_size=4, queue_depth=1,
+                                     quoting='minimal')
+        def write(k):
+            for i in range(2000):
+                writer.writerow([k, i])
+        threads = [threading.Thread(target=write, args=(k,))
+                   for k in range(2)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        writer.close()
+        lines = self.read().decode('ascii').split('\r\n')
+        self.assertEqual(sorted(lines[:-1]),
+                         sorted('%d,%d' % (k, i)
+                                for k in range(2) for i in range(2000)))
+
+    def it_rejects_a_reentrant_call(self):
+        writer = fastcsv.Writer.open(self.path)
+        def cells():
+            writer.writerow(['b'])
+            yield 'a'
+        with self.assertRaises(RuntimeError):
+            writer.writerow(cells())
+        writer.close()
+
+    def it_flushes_on_dealloc(self):
+        writer = fastcsv.Writer.open(self.path)
+        writer.writerow(['x'])
+        del writer
+        self.assertEqual(self.read(), b'"x"\r\n')
+
+    def it_raises_the_errors_of_write_on_the_next_call(self):
+        fd = os.open(self.path, os.O_RDONLY)
+        writer = fastcsv.Writer(fd, buffer_size=1)
+        with self.assertRaises(OSError):
+            for row in self.rows:
+                writer.writerow(row)
+        with self.assertRaises(OSError):
+            writer.writerow(['a'])
+        with self.assertRaises(OSError):
+            writer.close()
+
+        fd = os.open(self.path, os.O_RDONLY)
+        writer = fastcsv.Writer(fd)
+        writer.writerow(['a'])
+        with self.assertRaises(OSError):
+            writer.close()
+        with self.assertRaises(OSError):
+            os.fstat(fd)
+
+    def it_rejects_invalid_arguments(self):
+        with self.assertRaises(ValueError):
+            fastcsv.Writer(-1)
+        with self.assertRaises(ValueError):
+            fastcsv.Writer.open(self.path, queue_depth=0)
+        with self.assertRaises(OSError):
+            fastcsv.Writer.open(os.path.join(self.path, 'x'))